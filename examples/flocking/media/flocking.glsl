@@ -1,7 +1,13 @@
+// NUM_NEIGHBOURS and LOCAL_SIZE can be set by LoadShaderVariant.
+#ifndef NUM_NEIGHBOURS
 #define NUM_NEIGHBOURS 6
+#endif
+#ifndef LOCAL_SIZE
+#define LOCAL_SIZE 64
+#endif
 #define FLT_MAX 3.402823466e+38
 
-layout (local_size_x = 1) in;
+layout (local_size_x = LOCAL_SIZE) in;
 
 layout (std430, binding = 0) buffer AgentDataBlockIn
 {
@@ -17,9 +23,14 @@ layout (location = 0) uniform vec2 targetPos;
 layout (location = 1) uniform float maxMoveDist;
 layout (location = 2) uniform float maxRotation;
 layout (location = 3) uniform vec4 weights;
+uniform ivec3 agk_InvocationCount;
 
 void main()
 {
+	if (gl_GlobalInvocationID.x >= uint(agk_InvocationCount.x)) {
+		return;
+	}
+
 	vec2 agentPos = dataIn.agents[gl_GlobalInvocationID.x].xy;
 	vec2 agentDir = dataIn.agents[gl_GlobalInvocationID.x].zw;
 
@@ -29,7 +40,7 @@ void main()
 		neighbourDistsSquared[i] = FLT_MAX;
 	}
 
-	for (int i = 0; i < gl_NumWorkGroups.x; ++i) {
+	for (int i = 0; i < agk_InvocationCount.x; ++i) {
 		if (i != gl_GlobalInvocationID.x) {
 			vec2 neighbourPos = dataIn.agents[i].xy;
 			vec2 toNeighbour = neighbourPos - agentPos;
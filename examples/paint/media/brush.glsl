@@ -0,0 +1,15 @@
+// Shared by the shaders that draw shapes. Each one paints its shape in the draw colour over the input image.
+layout (local_size_x = 32, local_size_y = 32) in;
+
+layout(location = 0) uniform vec4 drawColour;
+
+layout(binding = 0, rgba8) uniform image2D imgIn;
+layout(binding = 1, rgba8) uniform image2D imgOut;
+
+// Blends the draw colour over the input image, where an alpha of 0.0 is entirely the draw colour.
+void paint(ivec2 coords, float alpha)
+{
+	vec4 baseColour = imageLoad(imgIn, coords);
+	vec4 colour = mix(drawColour, baseColour, alpha);
+	imageStore(imgOut, coords, colour);
+}
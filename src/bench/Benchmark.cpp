@@ -0,0 +1,219 @@
+// Headless benchmark of the plugin's own overhead. Runs on a surfaceless EGL context, with the stub AGK runtime in
+// place of the engine, so it needs neither a display nor a GPU; Mesa's llvmpipe is enough. Results are written as JSON
+// to the file given as the first argument, or to stdout.
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <GL/gl.h>
+#include "AGKLibraryCommands.h"
+#include "AGKStub.h"
+
+extern "C" {
+	int Compute_IsSupportedCompute();
+	unsigned int Compute_LoadShaderFromString(char *shaderSource);
+	unsigned int Compute_LoadShader(char *shaderFile);
+	void Compute_DeleteShader(unsigned int shaderID);
+	void Compute_RunShader(unsigned int shaderID, int numGroupsX, int numGroupsY, int numGroupsZ);
+	void Compute_SetShaderConstantByName(unsigned int shaderID, char *name, float v1, float v2, float v3, float v4);
+	unsigned int Compute_GetShaderConstantHandle(unsigned int shaderID, char *name);
+	void Compute_SetShaderConstantByHandle(unsigned int shaderID, unsigned int handle, float v1, float v2, float v3, float v4);
+	unsigned int Compute_CreateBuffer(int size);
+	void Compute_DeleteBuffer(unsigned int bufferID);
+	void Compute_SetShaderBuffer(unsigned int shaderID, unsigned int bufferID, unsigned int bindingPoint);
+	void Compute_UpdateBufferFromMemblock(unsigned int bufferID, unsigned int memblockID);
+	void Compute_CopyBufferToMemblock(unsigned int bufferID, unsigned int memblockID);
+}
+
+#define NUM_SAMPLES 15
+
+static char const kernelSource[] =
+	"layout (local_size_x = 64) in;\n"
+	"uniform vec4 params;\n"
+	"layout (std430, binding = 0) buffer Values {\n"
+	"	float values[];\n"
+	"} data;\n"
+	"void main()\n"
+	"{\n"
+	"	data.values[gl_GlobalInvocationID.x] += params.x;\n"
+	"}\n";
+
+#define TABLE_SHADER_FILE "benchmark_table.glsl"
+#define TABLE_SHADER_ENTRIES 4096
+
+static int const transferSizes[] = { 1 << 10, 1 << 16, 1 << 20, 1 << 24 };
+
+struct Result {
+	std::string name;
+	int size;
+	int operationsPerSample;
+	std::vector<double> samples;
+};
+
+static std::vector<Result> results;
+
+// Runs the operation NUM_SAMPLES times after one warm up run. Each sample is the time per operation in microseconds.
+// glFinish is included, so that work the driver defers is charged to the operation that caused it.
+template <typename Operation>
+static void Measure(char const *name, int size, int operationsPerSample, Operation operation)
+{
+	Result result;
+	result.name = name;
+	result.size = size;
+	result.operationsPerSample = operationsPerSample;
+
+	for (int sample = -1; sample < NUM_SAMPLES; ++sample) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < operationsPerSample; ++i) {
+			operation(i);
+		}
+		glFinish();
+		double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		if (sample >= 0) {
+			result.samples.push_back(elapsed / operationsPerSample);
+		}
+	}
+
+	results.push_back(result);
+}
+
+static void BenchmarkShaderLoad()
+{
+	// A different comment each time defeats any cache of compiled shaders in the driver.
+	Measure("LoadShaderFromString", 0, 1, [](int) {
+		static int loadCount = 0;
+		std::string source = std::string("// ") + std::to_string(loadCount++) + "\n" + kernelSource;
+		unsigned int shaderID = Compute_LoadShaderFromString(&source[0]);
+		Compute_DeleteShader(shaderID);
+	});
+}
+
+// Generated shaders often embed large lookup tables, one entry per line, which makes for a large file.
+static void BenchmarkShaderFileLoad()
+{
+	FILE *file = fopen(TABLE_SHADER_FILE, "w");
+	if (!file) {
+		fprintf(stderr, "Unable to write '%s'.\n", TABLE_SHADER_FILE);
+		return;
+	}
+	fprintf(file, "layout (local_size_x = 64) in;\r\n");
+	fprintf(file, "layout (std430, binding = 0) buffer Values {\r\n\tint values[];\r\n} data;\r\n");
+	fprintf(file, "const int table[%d] = int[](\r\n", TABLE_SHADER_ENTRIES);
+	for (int i = 0; i < TABLE_SHADER_ENTRIES; ++i) {
+		fprintf(file, "\t%d%s\r\n", (i * 7919) % 65536, i + 1 < TABLE_SHADER_ENTRIES ? "," : "");
+	}
+	fprintf(file, ");\r\nvoid main()\r\n{\r\n\tdata.values[gl_GlobalInvocationID.x] = table[gl_GlobalInvocationID.x];\r\n}\r\n");
+	long size = ftell(file);
+	fclose(file);
+
+	char fileName[] = TABLE_SHADER_FILE;
+	Measure("LoadShader", (int)size, 1, [&fileName](int) {
+		unsigned int shaderID = Compute_LoadShader(fileName);
+		Compute_DeleteShader(shaderID);
+	});
+	remove(TABLE_SHADER_FILE);
+}
+
+static void BenchmarkDispatch(unsigned int shaderID)
+{
+	Measure("RunShader", 0, 1000, [shaderID](int) {
+		Compute_RunShader(shaderID, 1, 1, 1);
+	});
+}
+
+static void BenchmarkUniforms(unsigned int shaderID)
+{
+	char name[] = "params";
+	Measure("SetShaderConstantByName", 0, 10000, [shaderID, &name](int i) {
+		Compute_SetShaderConstantByName(shaderID, name, (float)i, 0.0f, 0.0f, 0.0f);
+	});
+
+	unsigned int handle = Compute_GetShaderConstantHandle(shaderID, name);
+	Measure("SetShaderConstantByHandle", 0, 10000, [shaderID, handle](int i) {
+		Compute_SetShaderConstantByHandle(shaderID, handle, (float)i, 0.0f, 0.0f, 0.0f);
+	});
+}
+
+static void BenchmarkTransfers()
+{
+	for (size_t i = 0; i < sizeof(transferSizes) / sizeof(transferSizes[0]); ++i) {
+		int size = transferSizes[i];
+		int operations = std::max(1, (1 << 22) / size);
+		unsigned int memblockID = agk::CreateMemblock(size);
+		unsigned int bufferID = Compute_CreateBuffer(size);
+
+		Measure("UpdateBufferFromMemblock", size, operations, [bufferID, memblockID](int) {
+			Compute_UpdateBufferFromMemblock(bufferID, memblockID);
+		});
+		Measure("CopyBufferToMemblock", size, operations, [bufferID, memblockID](int) {
+			Compute_CopyBufferToMemblock(bufferID, memblockID);
+		});
+
+		Compute_DeleteBuffer(bufferID);
+		agk::DeleteMemblock(memblockID);
+	}
+}
+
+static void WriteResults(FILE *output)
+{
+	fprintf(output, "{\n\t\"renderer\": \"%s\",\n\t\"version\": \"%s\",\n\t\"results\": [", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+	for (size_t i = 0; i < results.size(); ++i) {
+		std::vector<double> samples = results[i].samples;
+		std::sort(samples.begin(), samples.end());
+		double mean = 0.0;
+		for (size_t j = 0; j < samples.size(); ++j) {
+			mean += samples[j];
+		}
+		mean /= samples.size();
+
+		fprintf(output, "%s\n\t\t{ \"name\": \"%s\", \"size\": %d, \"operations_per_sample\": %d, \"samples\": %u, \"min_us\": %.3f, \"median_us\": %.3f, \"mean_us\": %.3f }",
+			i == 0 ? "" : ",", results[i].name.c_str(), results[i].size, results[i].operationsPerSample, (unsigned int)samples.size(), samples.front(), samples[samples.size() / 2], mean);
+	}
+	fprintf(output, "\n\t]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (!AGKStub_CreateContext()) {
+		return 1;
+	}
+
+	AGKStub_Install();
+	if (!Compute_IsSupportedCompute()) {
+		fprintf(stderr, "Compute shaders are not supported by %s.\n", glGetString(GL_RENDERER));
+		return 1;
+	}
+
+	std::string source = kernelSource;
+	unsigned int shaderID = Compute_LoadShaderFromString(&source[0]);
+	unsigned int bufferID = Compute_CreateBuffer(64 * sizeof(float));
+	Compute_SetShaderBuffer(shaderID, bufferID, 0);
+
+	BenchmarkShaderLoad();
+	BenchmarkShaderFileLoad();
+	BenchmarkDispatch(shaderID);
+	BenchmarkUniforms(shaderID);
+	BenchmarkTransfers();
+
+	Compute_DeleteShader(shaderID);
+	Compute_DeleteBuffer(bufferID);
+
+	FILE *output = argc > 1 ? fopen(argv[1], "w") : stdout;
+	if (!output) {
+		fprintf(stderr, "Unable to open '%s' for writing.\n", argv[1]);
+		return 1;
+	}
+	WriteResults(output);
+	if (output != stdout) {
+		fclose(output);
+	}
+
+	if (AGKStub_GetErrorCount() > 0) {
+		fprintf(stderr, "The plugin reported %d errors.\n", AGKStub_GetErrorCount());
+		return 1;
+	}
+	return 0;
+}
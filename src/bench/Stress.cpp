@@ -0,0 +1,240 @@
+// Stress test of the plugin's object bookkeeping. Creates, uses and deletes thousands of buffers, shaders, command lists
+// and images in an interleaved order, checking every result, which the AGK test app cannot do at this scale. Runs on the
+// stub AGK runtime like the benchmark. Exits with 0 if every check passed and the plugin reported no errors.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "AGKLibraryCommands.h"
+#include "AGKStub.h"
+
+extern "C" {
+	int Compute_IsSupportedCompute();
+	void Compute_SetErrorMode(int mode);
+	unsigned int Compute_LoadShaderFromString(char *shaderSource);
+	void Compute_DeleteShader(unsigned int shaderID);
+	void Compute_RunShader(unsigned int shaderID, int numGroupsX, int numGroupsY, int numGroupsZ);
+	void Compute_SetShaderConstantIntByName(unsigned int shaderID, char *name, int v1, int v2, int v3, int v4);
+	void Compute_SetShaderImage(unsigned int shaderID, unsigned int imageID, unsigned int attachPoint);
+	unsigned int Compute_CreateBufferFromMemblock(unsigned int memblockID);
+	void Compute_DeleteBuffer(unsigned int bufferID);
+	int Compute_GetBufferSize(unsigned int bufferID);
+	void Compute_SetShaderBuffer(unsigned int shaderID, unsigned int bufferID, unsigned int bindingPoint);
+	void Compute_CopyBufferToMemblock(unsigned int bufferID, unsigned int memblockID);
+	unsigned int Compute_BeginCommandList();
+	void Compute_EndCommandList();
+	void Compute_ExecuteCommandList(unsigned int commandListID);
+	void Compute_DeleteCommandList(unsigned int commandListID);
+}
+
+#define NUM_BUFFERS 4000
+#define NUM_SHADERS 200
+#define NUM_COMMAND_LISTS 1000
+#define NUM_IMAGES 100
+#define VALUES_PER_BUFFER 16
+#define IMAGE_SIZE 8
+
+static char const addSource[] =
+	"layout (local_size_x = 16) in;\n"
+	"uniform ivec4 amount;\n"
+	"layout (std430, binding = 0) buffer Values {\n"
+	"	int values[16];\n"
+	"} data;\n"
+	"void main()\n"
+	"{\n"
+	"	data.values[gl_LocalInvocationID.x] += amount.x;\n"
+	"}\n";
+
+static char const fillSource[] =
+	"layout (local_size_x = 8, local_size_y = 8) in;\n"
+	"uniform ivec4 colour;\n"
+	"layout (binding = 0, rgba8) uniform image2D imgOut;\n"
+	"void main()\n"
+	"{\n"
+	"	imageStore(imgOut, ivec2(gl_LocalInvocationID.xy), vec4(colour) / 255.0);\n"
+	"}\n";
+
+static int failures = 0;
+
+static void Check(bool condition, char const *description, int index)
+{
+	if (!condition) {
+		failures += 1;
+		if (failures <= 20) {
+			fprintf(stderr, "Check failed: %s (%d).\n", description, index);
+		}
+	}
+}
+
+static unsigned int LoadShader(char const *source, int variant)
+{
+	// Each variant has different source, so the driver cannot hand back an earlier program.
+	std::string fullSource = std::string("// ") + std::to_string(variant) + "\n" + source;
+	return Compute_LoadShaderFromString(&fullSource[0]);
+}
+
+static unsigned int CreateBuffer(unsigned int memblockID, int firstValue)
+{
+	for (int i = 0; i < VALUES_PER_BUFFER; ++i) {
+		((int *)agk::GetMemblockPtr(memblockID))[i] = firstValue + i;
+	}
+	return Compute_CreateBufferFromMemblock(memblockID);
+}
+
+static bool BufferHolds(unsigned int bufferID, unsigned int memblockID, int firstValue)
+{
+	Compute_CopyBufferToMemblock(bufferID, memblockID);
+	for (int i = 0; i < VALUES_PER_BUFFER; ++i) {
+		if (((int *)agk::GetMemblockPtr(memblockID))[i] != firstValue + i) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Deletes every other buffer, refills the gaps, and checks that every buffer still holds what was written to it, and that
+// the IDs of the deleted buffers are not mistaken for the buffers that replaced them.
+static void StressBuffers(unsigned int memblockID)
+{
+	std::vector<unsigned int> buffers(NUM_BUFFERS);
+	std::vector<unsigned int> deletedBuffers;
+	std::vector<int> contents(NUM_BUFFERS);
+	for (int i = 0; i < NUM_BUFFERS; ++i) {
+		contents[i] = i * VALUES_PER_BUFFER;
+		buffers[i] = CreateBuffer(memblockID, contents[i]);
+		Check(buffers[i] != 0, "buffer created", i);
+	}
+	for (int i = 0; i < NUM_BUFFERS; i += 2) {
+		Compute_DeleteBuffer(buffers[i]);
+		deletedBuffers.push_back(buffers[i]);
+	}
+	for (int i = 0; i < NUM_BUFFERS; i += 2) {
+		contents[i] = -i * VALUES_PER_BUFFER;
+		buffers[i] = CreateBuffer(memblockID, contents[i]);
+		Check(buffers[i] != 0, "buffer recreated", i);
+	}
+	// Every use of a deleted ID is an error, so the count is reset around them.
+	Check(AGKStub_GetErrorCount() == 0, "no errors before using deleted IDs", 0);
+	AGKStub_ResetErrorCount();
+	AGKStub_SetErrorsPrinted(false);
+	for (size_t i = 0; i < deletedBuffers.size(); ++i) {
+		Check(Compute_GetBufferSize(deletedBuffers[i]) == 0, "deleted buffer ID rejected", (int)i);
+	}
+	AGKStub_SetErrorsPrinted(true);
+	Check(AGKStub_GetErrorCount() == (int)deletedBuffers.size(), "deleted buffer IDs reported", 0);
+	AGKStub_ResetErrorCount();
+	for (int i = 0; i < NUM_BUFFERS; ++i) {
+		Check(BufferHolds(buffers[i], memblockID, contents[i]), "buffer contents", i);
+		Compute_DeleteBuffer(buffers[i]);
+	}
+}
+
+// Each shader adds its own index to its own buffer, so a shader or buffer mixed up with another gives a wrong sum.
+static void StressShaders(unsigned int memblockID)
+{
+	char amountName[] = "amount";
+	std::vector<unsigned int> shaders(NUM_SHADERS);
+	std::vector<unsigned int> buffers(NUM_SHADERS);
+	for (int i = 0; i < NUM_SHADERS; ++i) {
+		shaders[i] = LoadShader(addSource, i);
+		Check(shaders[i] != 0, "shader loaded", i);
+		buffers[i] = CreateBuffer(memblockID, 0);
+		Compute_SetShaderBuffer(shaders[i], buffers[i], 0);
+		Compute_SetShaderConstantIntByName(shaders[i], amountName, i, 0, 0, 0);
+	}
+	for (int i = NUM_SHADERS - 1; i >= 0; --i) {
+		Compute_RunShader(shaders[i], 1, 1, 1);
+	}
+	for (int i = 0; i < NUM_SHADERS; ++i) {
+		Check(BufferHolds(buffers[i], memblockID, i), "shader result", i);
+		Compute_DeleteShader(shaders[i]);
+		Compute_DeleteBuffer(buffers[i]);
+	}
+}
+
+// Records a list per buffer that adds to it and reads it back, then executes each list a number of times that depends
+// on its index.
+static void StressCommandLists(unsigned int memblockID)
+{
+	char amountName[] = "amount";
+	unsigned int shaderID = LoadShader(addSource, NUM_SHADERS);
+	std::vector<unsigned int> commandLists(NUM_COMMAND_LISTS);
+	std::vector<unsigned int> buffers(NUM_COMMAND_LISTS);
+	for (int i = 0; i < NUM_COMMAND_LISTS; ++i) {
+		buffers[i] = CreateBuffer(memblockID, 0);
+		commandLists[i] = Compute_BeginCommandList();
+		Check(commandLists[i] != 0, "command list created", i);
+		Compute_SetShaderBuffer(shaderID, buffers[i], 0);
+		Compute_SetShaderConstantIntByName(shaderID, amountName, 1, 0, 0, 0);
+		Compute_RunShader(shaderID, 1, 1, 1);
+		Compute_EndCommandList();
+	}
+	for (int i = 0; i < NUM_COMMAND_LISTS; ++i) {
+		for (int j = 0; j < i % 4; ++j) {
+			Compute_ExecuteCommandList(commandLists[i]);
+		}
+	}
+	for (int i = 0; i < NUM_COMMAND_LISTS; ++i) {
+		Check(BufferHolds(buffers[i], memblockID, i % 4), "command list result", i);
+		Compute_DeleteCommandList(commandLists[i]);
+		Compute_DeleteBuffer(buffers[i]);
+	}
+	Compute_DeleteShader(shaderID);
+}
+
+// Fills each image with its own colour, then reads every image back.
+static void StressImages()
+{
+	char colourName[] = "colour";
+	unsigned int shaderID = LoadShader(fillSource, 0);
+	std::vector<unsigned int> images(NUM_IMAGES);
+	for (int i = 0; i < NUM_IMAGES; ++i) {
+		images[i] = AGKStub_CreateImage(IMAGE_SIZE, IMAGE_SIZE);
+		Compute_SetShaderImage(shaderID, images[i], 0);
+		Compute_SetShaderConstantIntByName(shaderID, colourName, i, 255 - i, i / 2, 255);
+		Compute_RunShader(shaderID, 1, 1, 1);
+	}
+
+	unsigned char pixels[IMAGE_SIZE * IMAGE_SIZE * 4];
+	for (int i = 0; i < NUM_IMAGES; ++i) {
+		bool matches = AGKStub_ReadImage(images[i], pixels);
+		for (int p = 0; p < IMAGE_SIZE * IMAGE_SIZE && matches; ++p) {
+			unsigned char *pixel = pixels + p * 4;
+			matches = pixel[0] == i && pixel[1] == 255 - i && pixel[2] == i / 2 && pixel[3] == 255;
+		}
+		Check(matches, "image contents", i);
+		AGKStub_DeleteImage(images[i]);
+	}
+	Compute_DeleteShader(shaderID);
+}
+
+int main()
+{
+	if (!AGKStub_CreateContext()) {
+		return 1;
+	}
+
+	AGKStub_Install();
+	if (!Compute_IsSupportedCompute()) {
+		fprintf(stderr, "Compute shaders are not supported.\n");
+		return 1;
+	}
+
+	// Report every error rather than only the first, so that the checks can count them.
+	Compute_SetErrorMode(2);
+
+	unsigned int memblockID = agk::CreateMemblock(VALUES_PER_BUFFER * sizeof(int));
+	StressBuffers(memblockID);
+	StressShaders(memblockID);
+	StressCommandLists(memblockID);
+	StressImages();
+	agk::DeleteMemblock(memblockID);
+
+	if (AGKStub_GetErrorCount() > 0) {
+		fprintf(stderr, "The plugin reported %d errors. The last was: %s\n", AGKStub_GetErrorCount(), AGKStub_GetLastError());
+		failures += 1;
+	}
+	printf("%s\n", failures == 0 ? "All stress checks passed." : "Stress checks failed.");
+	return failures == 0 ? 0 : 1;
+}
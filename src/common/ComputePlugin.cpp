@@ -1,9 +1,14 @@
 #include <cstdio>
 #include <cstdarg>
+#include <cctype>
 #include <cstdlib>
 #include <cstring>
 #include <climits>
+#include <chrono>
+#include <string>
+#include <algorithm>
 #include <unordered_map>
+#include <vector>
 #if defined(WIN32)
 #define WINDOWS_LEAN_AND_MEAN
 #include <Windows.h>
@@ -18,6 +23,29 @@
 #define MAX_IMAGE_BINDINGS 8
 #define MAX_BUFFER_BINDINGS 8
 
+#define MAX_CACHED_STORAGE_BINDINGS 64
+#define SHADER_CACHE_MAGIC 0x43474B41u
+#define SHADER_CACHE_VERSION 1
+#define SHADER_CACHE_HEADER_SIZE 16
+#define SPIRV_MAGIC 0x07230203u
+#define SPIRV_HEADER_SIZE 20
+#define UNKNOWN_BINDING 0xFFFFFFFFu
+
+// IDs handed to AGK pack a slot index into the low bits and the slot's generation above it. The generation is kept
+// small enough that IDs stay positive as AGK integers.
+#define SLOT_INDEX_BITS 20
+#define SLOT_INDEX_MASK ((1u << SLOT_INDEX_BITS) - 1)
+#define SLOT_GENERATION_MASK 0x7FFu
+#define NO_SLOT_ENTRY 0xFFFFFFFFu
+
+#define INVOCATION_COUNT_UNIFORM "agk_InvocationCount"
+
+#define NUM_TIMER_QUERIES 64
+#define MAX_TRACE_EVENTS 1000000
+
+#define PERSISTENT_BUFFER_READ 1
+#define PERSISTENT_BUFFER_WRITE 2
+
 static char const shaderVersion[] = "#version 440 core\n";
 
 #ifdef WIN32
@@ -35,6 +63,14 @@ PFNGLGETPROGRAMIVPROC glGetProgramiv;
 PFNGLGETPROGRAMINFOLOGPROC glGetProgramInfoLog;
 PFNGLUSEPROGRAMPROC glUseProgram;
 PFNGLDISPATCHCOMPUTEPROC glDispatchCompute;
+PFNGLDISPATCHCOMPUTEINDIRECTPROC glDispatchComputeIndirect;
+PFNGLGENQUERIESPROC glGenQueries;
+PFNGLDELETEQUERIESPROC glDeleteQueries;
+PFNGLBEGINQUERYPROC glBeginQuery;
+PFNGLENDQUERYPROC glEndQuery;
+PFNGLGETQUERYOBJECTIVPROC glGetQueryObjectiv;
+PFNGLGETQUERYOBJECTUI64VPROC glGetQueryObjectui64v;
+PFNGLQUERYCOUNTERPROC glQueryCounter;
 PFNGLGETINTEGERI_VPROC glGetIntegeri_v;
 PFNGLBINDIMAGETEXTUREPROC glBindImageTexture;
 PFNGLUNIFORM4FPROC glUniform4f;
@@ -49,14 +85,38 @@ PFNGLUNIFORM3IVPROC glUniform3iv;
 PFNGLUNIFORM4IVPROC glUniform4iv;
 PFNGLGETUNIFORMLOCATIONPROC glGetUniformLocation;
 PFNGLGETACTIVEUNIFORMPROC glGetActiveUniform;
+PFNGLGETPROGRAMRESOURCEIVPROC glGetProgramResourceiv;
+PFNGLGETPROGRAMINTERFACEIVPROC glGetProgramInterfaceiv;
+PFNGLGETPROGRAMRESOURCENAMEPROC glGetProgramResourceName;
 PFNGLGENBUFFERSPROC glGenBuffers;
 PFNGLDELETEBUFFERSPROC glDeleteBuffers;
 PFNGLBINDBUFFERPROC glBindBuffer;
 PFNGLBINDBUFFERBASEPROC glBindBufferBase;
 PFNGLBUFFERDATAPROC glBufferData;
+PFNGLBUFFERSUBDATAPROC glBufferSubData;
 PFNGLMAPBUFFERPROC glMapBuffer;
 PFNGLUNMAPBUFFERPROC glUnmapBuffer;
 PFNGLGETINTEGER64VPROC glGetInteger64v;
+PFNGLCOPYBUFFERSUBDATAPROC glCopyBufferSubData;
+PFNGLFENCESYNCPROC glFenceSync;
+PFNGLCLIENTWAITSYNCPROC glClientWaitSync;
+PFNGLDELETESYNCPROC glDeleteSync;
+PFNGLMEMORYBARRIERPROC glMemoryBarrier;
+PFNGLBUFFERSTORAGEPROC glBufferStorage;
+PFNGLMAPBUFFERRANGEPROC glMapBufferRange;
+PFNGLGETSTRINGIPROC glGetStringi;
+PFNGLGETPROGRAMBINARYPROC glGetProgramBinary;
+PFNGLPROGRAMBINARYPROC glProgramBinary;
+PFNGLPROGRAMPARAMETERIPROC glProgramParameteri;
+PFNGLGETACTIVEUNIFORMSIVPROC glGetActiveUniformsiv;
+PFNGLGETACTIVEUNIFORMBLOCKIVPROC glGetActiveUniformBlockiv;
+PFNGLGETACTIVEUNIFORMBLOCKNAMEPROC glGetActiveUniformBlockName;
+PFNGLUNIFORMBLOCKBINDINGPROC glUniformBlockBinding;
+PFNGLDEBUGMESSAGECALLBACKPROC glDebugMessageCallback;
+PFNGLDEBUGMESSAGECONTROLPROC glDebugMessageControl;
+PFNGLSHADERBINARYPROC glShaderBinary;
+PFNGLSPECIALIZESHADERPROC glSpecializeShader;
+PFNGLSPECIALIZESHADERARBPROC glSpecializeShaderARB;
 #endif
 
 void PluginError(char const *format, ...);
@@ -68,19 +128,107 @@ enum ErrorMode {
 	ERROR_MODE_STOP
 };
 
+enum ValidationLevel {
+	VALIDATION_LEVEL_OFF = 0,
+	VALIDATION_LEVEL_ERRORS,
+	VALIDATION_LEVEL_DEBUG
+};
+
+enum BarrierType {
+	BARRIER_SHADER_STORAGE = 0,
+	BARRIER_SHADER_IMAGE_ACCESS,
+	BARRIER_BUFFER_UPDATE,
+	BARRIER_COMMAND,
+	NUM_BARRIER_TYPES
+};
+
+static GLbitfield const barrierBits[NUM_BARRIER_TYPES] = {
+	GL_SHADER_STORAGE_BARRIER_BIT,
+	GL_SHADER_IMAGE_ACCESS_BARRIER_BIT,
+	GL_BUFFER_UPDATE_BARRIER_BIT,
+	GL_COMMAND_BARRIER_BIT
+};
+
+// Barriers needed before AGK itself can sample, copy or render to an image written by a compute shader.
+static GLbitfield const imageExternalBarrierBits = GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT;
+
 enum PluginState {
 	PLUGIN_STATE_UNINITIALISED,
 	PLUGIN_STATE_READY,
 	PLUGIN_STATE_UNSUPPORTED
 };
 
+// Plugin owned storage for a uniform block. Constants are written into the shadow copy, and the range written since the
+// last dispatch is uploaded with a single call. Blocks shared between shaders by ShareShaderConstantBlock point at the
+// same UniformBuffer, so it is reference counted.
+struct UniformBuffer
+{
+	GLuint bufferName;
+	GLint size;
+	unsigned char *shadow;
+	GLint dirtyStart;
+	GLint dirtyEnd;
+	unsigned int refCount;
+
+	UniformBuffer(GLint dataSize)
+	{
+		size = dataSize;
+		shadow = (unsigned char *)calloc(size, 1);
+		dirtyStart = size;
+		dirtyEnd = 0;
+		refCount = 1;
+		glGenBuffers(1, &bufferName);
+		glBindBuffer(GL_UNIFORM_BUFFER, bufferName);
+		glBufferData(GL_UNIFORM_BUFFER, size, shadow, GL_DYNAMIC_DRAW);
+	}
+
+	~UniformBuffer()
+	{
+		glDeleteBuffers(1, &bufferName);
+		free(shadow);
+	}
+
+	void markDirty(GLint start, GLint end)
+	{
+		if (start < dirtyStart) {
+			dirtyStart = start;
+		}
+		if (end > dirtyEnd) {
+			dirtyEnd = end;
+		}
+	}
+
+	void flush()
+	{
+		if (dirtyEnd > dirtyStart) {
+			glBindBuffer(GL_UNIFORM_BUFFER, bufferName);
+			glBufferSubData(GL_UNIFORM_BUFFER, dirtyStart, dirtyEnd - dirtyStart, shadow + dirtyStart);
+			dirtyStart = size;
+			dirtyEnd = 0;
+		}
+	}
+
+	void release()
+	{
+		if (--refCount == 0) {
+			delete this;
+		}
+	}
+};
+
 struct Uniform
 {
 	GLenum type;
 	GLint size;
 	GLint vecSize;
 	GLint location;
+	GLint stride;
+	GLint offset;
+	UniformBuffer *buffer;
+	bool consecutiveLocations;
 	bool dirty;
+	GLint dirtyFirst;
+	GLint dirtyEnd;
 	void *data;
 
 	char *getName()
@@ -88,25 +236,38 @@ struct Uniform
 		return (char *)this + sizeof(Uniform);
 	}
 
-	template<typename T>
-	void set(int index, T v1, T v2, T v3, T v4)
+	bool canSet(int index)
 	{
 		if (index < 0) {
 			PluginError("Failed to set shader constant '%s' at index %d. Negative indices are not permitted.", getName(), index, size);
-			return;
+			return false;
 		}
 
 		if (index >= size) {
 			PluginError("Failed to set shader constant '%s' at index %d. Uniform only has %d elements.", getName(), index, size);
-			return;
+			return false;
 		}
 
 		if (vecSize == 0) {
 			PluginError("Failed to set shader constant '%s', as it is of an unsupported type. Only float, vec, int and ivec uniforms are supported.", getName());
-			return;
+			return false;
+		}
+
+		return true;
+	}
+
+	template<typename T>
+	void set(int index, T v1, T v2, T v3, T v4)
+	{
+		if (canSet(index)) {
+			store(index, v1, v2, v3, v4);
 		}
+	}
 
-		T *elem = (T *)data + (index * vecSize);
+	template<typename T>
+	void store(int index, T v1, T v2, T v3, T v4)
+	{
+		T *elem = (T *)((unsigned char *)data + index * stride);
 		if (vecSize > 0) {
 			elem[0] = v1;
 			if (vecSize > 1) {
@@ -120,35 +281,73 @@ struct Uniform
 			}
 		}
 
-		dirty = true;
+		markDirty(index, index + 1);
+	}
+
+	// Copies count tightly packed elements, starting at element 0.
+	void load(void const *source, int count)
+	{
+		size_t elementSize = sizeof(float) * vecSize;
+		if (stride == (GLint)elementSize) {
+			memcpy(data, source, elementSize * count);
+		}
+		else {
+			for (int i = 0; i < count; ++i) {
+				memcpy((unsigned char *)data + i * stride, (unsigned char const *)source + i * elementSize, elementSize);
+			}
+		}
+		markDirty(0, count);
+	}
+
+	// Uniforms in a block are uploaded with the rest of the block, rather than by apply.
+	void markDirty(int firstIndex, int lastIndex)
+	{
+		if (buffer) {
+			buffer->markDirty(offset + firstIndex * stride, offset + (lastIndex - 1) * stride + (GLint)sizeof(float) * vecSize);
+		}
+		else {
+			if (!dirty || firstIndex < dirtyFirst) {
+				dirtyFirst = firstIndex;
+			}
+			if (!dirty || lastIndex > dirtyEnd) {
+				dirtyEnd = lastIndex;
+			}
+			dirty = true;
+		}
 	}
 
+	// Only the elements set since the last upload are sent, which relies on array elements having consecutive locations.
 	void apply()
 	{
+		GLint first = consecutiveLocations ? dirtyFirst : 0;
+		GLint count = consecutiveLocations ? dirtyEnd - dirtyFirst : size;
+		GLint elementLocation = location + first;
+		GLfloat *floatData = (GLfloat *)data + first * vecSize;
+		GLint *intData = (GLint *)data + first * vecSize;
 		switch (type) {
 			case GL_FLOAT:
-				glUniform1fv(location, size, (GLfloat *)data);
+				glUniform1fv(elementLocation, count, floatData);
 				break;
 			case GL_FLOAT_VEC2:
-				glUniform2fv(location, size, (GLfloat *)data);
+				glUniform2fv(elementLocation, count, floatData);
 				break;
 			case GL_FLOAT_VEC3:
-				glUniform3fv(location, size, (GLfloat *)data);
+				glUniform3fv(elementLocation, count, floatData);
 				break;
 			case GL_FLOAT_VEC4:
-				glUniform4fv(location, size, (GLfloat *)data);
+				glUniform4fv(elementLocation, count, floatData);
 				break;
 			case GL_INT:
-				glUniform1iv(location, size, (GLint *)data);
+				glUniform1iv(elementLocation, count, intData);
 				break;
 			case GL_INT_VEC2:
-				glUniform2iv(location, size, (GLint *)data);
+				glUniform2iv(elementLocation, count, intData);
 				break;
 			case GL_INT_VEC3:
-				glUniform3iv(location, size, (GLint *)data);
+				glUniform3iv(elementLocation, count, intData);
 				break;
 			case GL_INT_VEC4:
-				glUniform4iv(location, size, (GLint *)data);
+				glUniform4iv(elementLocation, count, intData);
 				break;
 			default:
 				PluginError("Shader constant '%s' has unsupported type. Only float, vec, int and ivec uniforms are supported.", getName());
@@ -156,28 +355,52 @@ struct Uniform
 		}
 		dirty = false;
 	}
-
-	template <typename T>
-	bool matchesIdentifier(T identifier);
 };
 
-template<>
-bool Uniform::matchesIdentifier<unsigned int>(unsigned int identifier)
-{
-	return location == identifier;
-}
-
-template<>
-bool Uniform::matchesIdentifier<char *>(char *identifier)
-{
-	return strcmp(identifier, getName()) == 0;
-}
+// Identifies a uniform by the handle returned from GetShaderConstantHandle, which is its position in the shader's handle
+// table plus one.
+struct UniformHandle {
+	unsigned int value;
+};
 
 struct UniformBufferBinding {
 	unsigned int bufferID;
 	unsigned int bindingPoint;
 };
 
+struct UniformBlock {
+	GLuint binding;
+	UniformBuffer *buffer;
+	char *name;
+};
+
+struct ComputeShader;
+
+// Where a shader's source came from, so that it can be built again when its files change. sourceFile is empty for
+// shaders loaded from strings, which are never reloaded.
+struct ShaderOrigin
+{
+	std::string sourceFile;
+	std::string defineList;
+	// The hash of the shader file's own text, and the cache key of the source built from it and its includes, as last
+	// loaded or reloaded, whether or not that succeeded.
+	unsigned long long fileHash;
+	unsigned long long sourceKey;
+	// Every file the shader includes, directly or through other includes, in the order they were first included.
+	std::vector<std::string> includes;
+	// The shader storage blocks the source declares readonly; see FindReadOnlyBlocks.
+	std::vector<std::string> readOnlyBlocks;
+};
+
+// A program compiled by LoadShaderVariant. Loading the same source with the same defines again gives a new shader that
+// shares the program, with constants and bindings of its own. As constants are stored in the program, the shader whose
+// constants it currently holds is tracked, and another shader sends all of its own before it runs.
+struct ShaderVariant
+{
+	GLuint programName;
+	ComputeShader *uniformOwner;
+};
+
 struct ComputeShader
 {
 	GLuint programName;
@@ -186,22 +409,58 @@ struct ComputeShader
 	GLuint numUniforms;
 	GLuint uniformSize;
 	unsigned char *uniforms;
+	GLuint *nameIndex;
+	GLuint *locationIndex;
+	std::vector<UniformBlock> blocks;
+	GLint localSize[3];
+	Uniform *invocationCount;
+	float gpuTime;
+	ShaderOrigin origin;
+	ShaderVariant *variant;
+	// The uniform index that each handle refers to, or -1 where a reload removed the uniform. Handles start out as the
+	// uniform indices plus one, and keep referring to the same names when a reload changes the order of the uniforms.
+	std::vector<int> handleUniforms;
+	// Storage buffer binding points that only readonly blocks use, so dispatches don't count as writing their buffers.
+	std::vector<GLuint> readOnlyBindings;
 
 	ComputeShader(GLuint program) {
 		programName = program;
+		variant = NULL;
 		memset(imageBindings, 0, sizeof(imageBindings));
 		memset(bufferBindings, 0, sizeof(bufferBindings));
 
+		// Each block is given its own binding point, as blocks without a binding in the shader all default to zero. Programs
+		// linked from SPIR-V have no names, which the driver may report as a length of zero rather than an empty string.
+		GLint numBlocks;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &numBlocks);
+		for (GLint i = 0; i < numBlocks; ++i) {
+			GLint dataSize, nameLength;
+			glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+			glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_NAME_LENGTH, &nameLength);
+			UniformBlock block;
+			block.binding = i;
+			block.buffer = new UniformBuffer(dataSize);
+			nameLength = std::max(nameLength, 1);
+			block.name = (char *)malloc(nameLength);
+			block.name[0] = '\0';
+			glGetActiveUniformBlockName(program, i, nameLength, NULL, block.name);
+			glUniformBlockBinding(program, i, i);
+			blocks.push_back(block);
+		}
+
 		GLint maxNameSize;
 		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameSize);
+		maxNameSize = std::max(maxNameSize, 1);
 		uniformSize = sizeof(Uniform) + maxNameSize;
 
 		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, (GLint *)&numUniforms);
 		uniforms = (unsigned char *)malloc(uniformSize * numUniforms);
 
+		char *elementName = (char *)malloc(maxNameSize + 16);
 		unsigned char *next = uniforms;
 		for (GLuint i = 0; i < numUniforms; ++i) {
 			Uniform *uniform = (Uniform *)next;
+			uniform->getName()[0] = '\0';
 			glGetActiveUniform(program, i, maxNameSize, NULL, &uniform->size, &uniform->type, uniform->getName());
 			for (char *c = uniform->getName(); *c; ++c) {
 				if (*c == '[') {
@@ -209,7 +468,14 @@ struct ComputeShader
 					break;
 				}
 			}
-			uniform->location = glGetUniformLocation(program, uniform->getName());
+			// SPIR-V uniforms have no names to look their locations up by, so they are asked for by index instead.
+			if (uniform->getName()[0]) {
+				uniform->location = glGetUniformLocation(program, uniform->getName());
+			}
+			else {
+				GLenum locationProperty = GL_LOCATION;
+				glGetProgramResourceiv(program, GL_UNIFORM, i, 1, &locationProperty, 1, NULL, &uniform->location);
+			}
 			uniform->vecSize = 0;
 			switch (uniform->type) {
 				case GL_FLOAT: case GL_INT:
@@ -221,92 +487,834 @@ struct ComputeShader
 				case GL_FLOAT_VEC4: case GL_INT_VEC4:
 					uniform->vecSize = 4; break;
 			}
-			if (uniform->vecSize > 0) {
-				uniform->data = malloc(sizeof(float) * uniform->size * uniform->vecSize);
+			GLint blockIndex;
+			glGetActiveUniformsiv(program, 1, &i, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+			if (blockIndex >= 0) {
+				glGetActiveUniformsiv(program, 1, &i, GL_UNIFORM_OFFSET, &uniform->offset);
+				glGetActiveUniformsiv(program, 1, &i, GL_UNIFORM_ARRAY_STRIDE, &uniform->stride);
+				if (uniform->stride == 0) {
+					uniform->stride = sizeof(float) * uniform->vecSize;
+				}
+				uniform->buffer = blocks[blockIndex].buffer;
+				uniform->data = uniform->buffer->shadow + uniform->offset;
+				uniform->consecutiveLocations = false;
+				uniform->dirty = false;
+			}
+			else if (uniform->vecSize > 0) {
+				uniform->offset = 0;
+				uniform->stride = sizeof(float) * uniform->vecSize;
+				uniform->buffer = NULL;
+				uniform->data = calloc(uniform->size * uniform->vecSize, sizeof(float));
+				// Arrays in SPIR-V always take consecutive locations, and have no element names to check them with.
+				uniform->consecutiveLocations = true;
+				if (uniform->size > 1 && uniform->getName()[0]) {
+					snprintf(elementName, maxNameSize + 16, "%s[%d]", uniform->getName(), uniform->size - 1);
+					uniform->consecutiveLocations = glGetUniformLocation(program, elementName) == uniform->location + uniform->size - 1;
+				}
 				uniform->dirty = true;
+				uniform->dirtyFirst = 0;
+				uniform->dirtyEnd = uniform->size;
 			}
 			else {
+				uniform->offset = 0;
+				uniform->stride = 0;
+				uniform->buffer = NULL;
 				uniform->data = NULL;
+				uniform->consecutiveLocations = false;
 				uniform->dirty = false;
 			}
 			next += uniformSize;
 		}
+		free(elementName);
+
+		// Uniform indices sorted by name and by location, so that either can be found with a binary search.
+		nameIndex = (GLuint *)malloc(sizeof(GLuint) * numUniforms);
+		locationIndex = (GLuint *)malloc(sizeof(GLuint) * numUniforms);
+		handleUniforms.resize(numUniforms);
+		for (GLuint i = 0; i < numUniforms; ++i) {
+			nameIndex[i] = i;
+			locationIndex[i] = i;
+			handleUniforms[i] = (int)i;
+		}
+		std::sort(nameIndex, nameIndex + numUniforms, [this](GLuint a, GLuint b) {
+			return strcmp(getUniform(a)->getName(), getUniform(b)->getName()) < 0;
+		});
+		std::sort(locationIndex, locationIndex + numUniforms, [this](GLuint a, GLuint b) {
+			return (unsigned int)getUniform(a)->location < (unsigned int)getUniform(b)->location;
+		});
+
+		glGetProgramiv(program, GL_COMPUTE_WORK_GROUP_SIZE, localSize);
+
+		gpuTime = 0.0f;
+
+		invocationCount = findUniformByName(INVOCATION_COUNT_UNIFORM);
+		if (invocationCount && invocationCount->type != GL_INT_VEC3) {
+			invocationCount = NULL;
+		}
 	}
 
 	~ComputeShader()
 	{
+		if (variant && variant->uniformOwner == this) {
+			variant->uniformOwner = NULL;
+		}
 		for (GLuint i = 0; i < numUniforms; ++i) {
-			free(getUniform(i)->data);
+			Uniform *uniform = getUniform(i);
+			if (!uniform->buffer) {
+				free(uniform->data);
+			}
 		}
 		free(uniforms);
+		free(nameIndex);
+		free(locationIndex);
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			blocks[i].buffer->release();
+			free(blocks[i].name);
+		}
+	}
+
+	void applyUniforms()
+	{
+		if (variant && variant->uniformOwner != this) {
+			for (GLuint i = 0; i < numUniforms; ++i) {
+				Uniform *uniform = getUniform(i);
+				if (!uniform->buffer && uniform->data) {
+					uniform->markDirty(0, uniform->size);
+				}
+			}
+			variant->uniformOwner = this;
+		}
+		for (GLuint i = 0; i < numUniforms; ++i) {
+			Uniform *uniform = getUniform(i);
+			if (uniform->dirty) {
+				uniform->apply();
+			}
+		}
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			blocks[i].buffer->flush();
+			glBindBufferBase(GL_UNIFORM_BUFFER, blocks[i].binding, blocks[i].buffer->bufferName);
+		}
+	}
+
+	UniformBlock *findBlock(char const *name)
+	{
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			if (strcmp(blocks[i].name, name) == 0) {
+				return &blocks[i];
+			}
+		}
+		return NULL;
+	}
+
+	void shareBlock(UniformBlock *block, UniformBuffer *buffer)
+	{
+		for (GLuint i = 0; i < numUniforms; ++i) {
+			Uniform *uniform = getUniform(i);
+			if (uniform->buffer == block->buffer) {
+				uniform->buffer = buffer;
+				uniform->data = buffer->shadow + uniform->offset;
+			}
+		}
+		buffer->refCount += 1;
+		block->buffer->release();
+		block->buffer = buffer;
 	}
 
 	Uniform *getUniform(unsigned int index)
 	{
 		return (Uniform *)&uniforms[index * uniformSize];
 	}
+
+	unsigned int getHandle(Uniform *uniform)
+	{
+		int index = (int)(((unsigned char *)uniform - uniforms) / uniformSize);
+		if (index < (int)handleUniforms.size() && handleUniforms[index] == index) {
+			return index + 1;
+		}
+		for (size_t i = 0; i < handleUniforms.size(); ++i) {
+			if (handleUniforms[i] == index) {
+				return (unsigned int)i + 1;
+			}
+		}
+		return 0;
+	}
+
+	Uniform *findUniformByName(char const *identifier)
+	{
+		GLuint *end = nameIndex + numUniforms;
+		GLuint *found = std::lower_bound(nameIndex, end, identifier, [this](GLuint i, char const *name) {
+			return strcmp(getUniform(i)->getName(), name) < 0;
+		});
+		if (found != end && strcmp(getUniform(*found)->getName(), identifier) == 0) {
+			return getUniform(*found);
+		}
+		return NULL;
+	}
+
+	// A binding point is only read-only if every block bound to it is declared readonly, as blocks can share one.
+	void findReadOnlyBindings()
+	{
+		readOnlyBindings.clear();
+		if (origin.readOnlyBlocks.empty()) {
+			return;
+		}
+
+		std::vector<GLuint> writtenBindings;
+		GLint numBlocks, maxNameLength;
+		glGetProgramInterfaceiv(programName, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &numBlocks);
+		glGetProgramInterfaceiv(programName, GL_SHADER_STORAGE_BLOCK, GL_MAX_NAME_LENGTH, &maxNameLength);
+		std::vector<char> name(std::max(maxNameLength, 1));
+		for (GLint i = 0; i < numBlocks; ++i) {
+			GLenum bindingProperty = GL_BUFFER_BINDING;
+			GLint binding;
+			glGetProgramResourceiv(programName, GL_SHADER_STORAGE_BLOCK, i, 1, &bindingProperty, 1, NULL, &binding);
+			name[0] = '\0';
+			glGetProgramResourceName(programName, GL_SHADER_STORAGE_BLOCK, i, (GLsizei)name.size(), NULL, &name[0]);
+			// Each element of an array of blocks is reported separately, as Name[0], Name[1] and so on.
+			char *bracket = strchr(&name[0], '[');
+			if (bracket) {
+				*bracket = '\0';
+			}
+			if (std::find(origin.readOnlyBlocks.begin(), origin.readOnlyBlocks.end(), &name[0]) != origin.readOnlyBlocks.end()) {
+				readOnlyBindings.push_back(binding);
+			}
+			else {
+				writtenBindings.push_back(binding);
+			}
+		}
+		for (size_t i = 0; i < writtenBindings.size(); ++i) {
+			readOnlyBindings.erase(std::remove(readOnlyBindings.begin(), readOnlyBindings.end(), writtenBindings[i]), readOnlyBindings.end());
+		}
+	}
+
+	bool isReadOnlyBinding(GLuint bindingPoint)
+	{
+		return std::find(readOnlyBindings.begin(), readOnlyBindings.end(), bindingPoint) != readOnlyBindings.end();
+	}
+
+	template <typename T>
+	Uniform *findUniform(T identifier);
+
+	void setInvocationCount(int countX, int countY, int countZ);
 };
 
+template<>
+Uniform *ComputeShader::findUniform<unsigned int>(unsigned int identifier)
+{
+	GLuint *end = locationIndex + numUniforms;
+	GLuint *found = std::lower_bound(locationIndex, end, identifier, [this](GLuint i, unsigned int location) {
+		return (unsigned int)getUniform(i)->location < location;
+	});
+	if (found != end && (unsigned int)getUniform(*found)->location == identifier) {
+		return getUniform(*found);
+	}
+	return NULL;
+}
+
+template<>
+Uniform *ComputeShader::findUniform<char *>(char *identifier)
+{
+	return findUniformByName(identifier);
+}
+
+template<>
+Uniform *ComputeShader::findUniform<UniformHandle>(UniformHandle identifier)
+{
+	if (identifier.value == 0 || identifier.value > handleUniforms.size()) {
+		return NULL;
+	}
+	int index = handleUniforms[identifier.value - 1];
+	return index >= 0 ? getUniform(index) : NULL;
+}
+
 struct BufferObject {
 	GLuint bufferName;
 	GLsizei bufferSize;
+	int persistentFlags;
+	void *mappedData;
+	GLsync fence;
+	unsigned int writeSerial;
 
 	BufferObject(GLuint name, GLsizei size)
 	{
 		bufferName = name;
 		bufferSize = size;
+		writeSerial = 0;
+		persistentFlags = 0;
+		mappedData = NULL;
+		fence = NULL;
 	}
 
 	~BufferObject()
 	{
+		if (fence) {
+			glDeleteSync(fence);
+		}
 		glDeleteBuffers(1, &bufferName);
 	}
+
+	// Block until the GPU has finished with every dispatch that used the persistently mapped store.
+	bool waitForGPU()
+	{
+		if (!fence) {
+			return true;
+		}
+
+		GLenum status;
+		do {
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		} while (status == GL_TIMEOUT_EXPIRED);
+
+		glDeleteSync(fence);
+		fence = NULL;
+		return status != GL_WAIT_FAILED;
+	}
 };
 
-typedef std::unordered_map<unsigned int, ComputeShader *> ComputerShaderMap;
-typedef std::unordered_map<unsigned int, BufferObject *> BufferObjectMap;
+// A shader started by LoadShaderAsync that has not yet been checked for success. Failed shaders stay here, with their
+// OpenGL objects deleted, until DeleteShader is called so that GetShaderStatus can keep reporting the failure.
+struct PendingShader {
+	GLuint shaderName;
+	GLuint programName;
+	unsigned long long cacheKey;
+	bool saveToCache;
+	bool failed;
+	ShaderOrigin origin;
+};
 
-ErrorMode errorMode = ERROR_MODE_REPORT_FIRST;
-PluginState pluginState = PLUGIN_STATE_UNINITIALISED;
-unsigned int nextShaderID = 1;
-ComputerShaderMap computeShaders;
-unsigned int nextBufferID = 1;
-BufferObjectMap bufferObjects;
-bool errorReported;
+// An #include line in shader source, from its first character up to, but not including, its newline.
+struct IncludeDirective {
+	size_t start;
+	size_t end;
+	int line;
+	std::string path;
+};
 
-void PluginError(char const *format, ...)
+// A file included by shaders. Each is read and searched for includes of its own once, however many shaders include it.
+struct IncludeFile {
+	std::string source;
+	unsigned long long hash;
+	std::vector<IncludeDirective> directives;
+};
+
+struct StagingBuffer {
+	GLuint bufferName;
+	GLsizei bufferSize;
+};
+
+typedef std::vector<StagingBuffer> StagingBufferPool;
+
+StagingBufferPool stagingBuffers;
+
+struct Readback {
+	StagingBuffer staging;
+	GLsizei size;
+	GLsync fence;
+	bool flushed;
+	unsigned int memblockID;
+
+	Readback(StagingBuffer stagingBuffer, GLsizei copySize, GLsync sync, unsigned int memblock)
+	{
+		staging = stagingBuffer;
+		size = copySize;
+		fence = sync;
+		flushed = false;
+		memblockID = memblock;
+	}
+
+	~Readback()
+	{
+		glDeleteSync(fence);
+		stagingBuffers.push_back(staging);
+	}
+};
+
+// Registry of the objects behind the IDs handed to AGK. Creating, finding and deleting are all constant time, with no
+// hashing or allocation once the arrays have grown. A slot's generation changes whenever it is freed, so a stale ID for
+// a deleted object is recognised even after the slot has been reused. The objects are kept densely packed, with their
+// IDs, so iterating over them skips no empty slots. Iterators have first and second members, like those of the maps
+// this replaced, but deleting an object moves the last one into its place.
+template <typename T>
+class SlotMap
 {
-	if (ERROR_MODE_IGNORE == errorMode) {
-		return;
+public:
+	struct Entry {
+		unsigned int first;
+		T *second;
+	};
+	typedef Entry *iterator;
+
+	iterator begin()
+	{
+		return entries.empty() ? NULL : &entries[0];
 	}
 
-	if (errorReported) {
-		if (ERROR_MODE_REPORT_FIRST == errorMode) {
-			return;
+	iterator end()
+	{
+		return begin() + entries.size();
+	}
+
+	iterator find(unsigned int id)
+	{
+		Slot *slot = findSlot(id);
+		if (!slot || slot->entryIndex == NO_SLOT_ENTRY) {
+			return end();
 		}
+		return begin() + slot->entryIndex;
 	}
-	else {
-		errorReported = true;
+
+	unsigned int insert(T *value)
+	{
+		unsigned int id = reserve();
+		if (id) {
+			fill(id, value);
+		}
+		return id;
 	}
 
-	char str[512];
+	// Allocates an ID with no object behind it yet. find treats it as unknown until fill is called, or it is released.
+	unsigned int reserve()
+	{
+		unsigned int index;
+		if (!freeSlots.empty()) {
+			index = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else {
+			if (slots.size() == SLOT_INDEX_MASK) {
+				PluginError("Unable to create any more objects. The limit of %u has been reached.", SLOT_INDEX_MASK);
+				return 0;
+			}
+			index = (unsigned int)slots.size();
+			Slot slot = { 0, NO_SLOT_ENTRY };
+			slots.push_back(slot);
+		}
+		return (slots[index].generation << SLOT_INDEX_BITS) | (index + 1);
+	}
 
-	va_list args;
-	va_start(args, format);
+	void fill(unsigned int id, T *value)
+	{
+		Entry entry = { id, value };
+		findSlot(id)->entryIndex = (unsigned int)entries.size();
+		entries.push_back(entry);
+	}
 
-	vsnprintf(str, 512, format, args);
-	agk::PluginError(str);
+	void release(unsigned int id)
+	{
+		Slot *slot = findSlot(id);
+		if (slot) {
+			slot->generation = (slot->generation + 1) & SLOT_GENERATION_MASK;
+			slot->entryIndex = NO_SLOT_ENTRY;
+			freeSlots.push_back((id & SLOT_INDEX_MASK) - 1);
+		}
+	}
 
-	va_end(args);
+	void erase(iterator iter)
+	{
+		unsigned int entryIndex = (unsigned int)(iter - begin());
+		release(iter->first);
+		if (entryIndex + 1 != entries.size()) {
+			entries[entryIndex] = entries.back();
+			findSlot(entries[entryIndex].first)->entryIndex = entryIndex;
+		}
+		entries.pop_back();
+	}
 
-	if (ERROR_MODE_STOP == errorMode) {
-		exit(-1);
+private:
+	struct Slot {
+		unsigned int generation;
+		unsigned int entryIndex;
+	};
+
+	std::vector<Slot> slots;
+	std::vector<unsigned int> freeSlots;
+	std::vector<Entry> entries;
+
+	Slot *findSlot(unsigned int id)
+	{
+		// ID 0 wraps around to an index past the end, so it is rejected along with every other out of range index.
+		unsigned int index = (id & SLOT_INDEX_MASK) - 1;
+		if (index >= slots.size() || slots[index].generation != id >> SLOT_INDEX_BITS) {
+			return NULL;
+		}
+		return &slots[index];
 	}
-}
+};
 
-bool CheckInit()
-{
-	switch (pluginState) {
+typedef SlotMap<ComputeShader> ComputerShaderMap;
+typedef std::unordered_map<unsigned int, PendingShader *> PendingShaderMap;
+typedef std::unordered_map<std::string, IncludeFile *> IncludeFileMap;
+typedef std::unordered_map<unsigned long long, ShaderVariant *> ShaderVariantMap;
+typedef SlotMap<BufferObject> BufferObjectMap;
+typedef SlotMap<Readback> ReadbackMap;
+typedef std::unordered_map<GLuint, unsigned int> ImageWriteSerialMap;
+
+enum CommandType {
+	COMMAND_DISPATCH,
+	COMMAND_SET_UNIFORM,
+	COMMAND_LOAD_UNIFORM,
+	COMMAND_UPDATE_BUFFER,
+	COMMAND_COPY_BUFFER
+};
+
+struct BufferBindingRef {
+	GLuint bindingPoint;
+	BufferObject *bufferObject;
+};
+
+struct ImageBindingRef {
+	GLuint attachPoint;
+	unsigned int imageID;
+};
+
+struct DispatchCommand {
+	ComputeShader *computeShader;
+	GLuint numGroups[3];
+	BufferObject *indirectBuffer;
+	GLintptr indirectOffset;
+	unsigned int firstBufferBinding;
+	unsigned int numBufferBindings;
+	unsigned int firstImageBinding;
+	unsigned int numImageBindings;
+};
+
+struct SetUniformCommand {
+	ComputeShader *computeShader;
+	Uniform *uniform;
+	int index;
+	bool isInt;
+	union {
+		float f[4];
+		int i[4];
+	} values;
+};
+
+struct LoadUniformCommand {
+	ComputeShader *computeShader;
+	Uniform *uniform;
+	unsigned int memblockID;
+	int memblockOffset;
+	int count;
+};
+
+struct TransferCommand {
+	BufferObject *bufferObject;
+	unsigned int memblockID;
+	int bufferOffset;
+	int memblockOffset;
+	int size;
+};
+
+struct Command {
+	CommandType type;
+	union {
+		DispatchCommand dispatch;
+		SetUniformCommand setUniform;
+		LoadUniformCommand loadUniform;
+		TransferCommand transfer;
+	};
+};
+
+struct CommandList {
+	std::vector<Command> commands;
+	std::vector<BufferBindingRef> bufferBindings;
+	std::vector<ImageBindingRef> imageBindings;
+	bool valid;
+	float gpuTime;
+
+	CommandList()
+	{
+		valid = true;
+		gpuTime = 0.0f;
+	}
+
+	template <typename T>
+	void recordSetUniform(ComputeShader *computeShader, Uniform *uniform, int index, T v1, T v2, T v3, T v4);
+
+	bool references(ComputeShader *computeShader)
+	{
+		for (std::vector<Command>::iterator iter = commands.begin(); iter != commands.end(); ++iter) {
+			if ((iter->type == COMMAND_DISPATCH && iter->dispatch.computeShader == computeShader) ||
+				(iter->type == COMMAND_SET_UNIFORM && iter->setUniform.computeShader == computeShader) ||
+				(iter->type == COMMAND_LOAD_UNIFORM && iter->loadUniform.computeShader == computeShader)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool references(BufferObject *bufferObject)
+	{
+		for (std::vector<BufferBindingRef>::iterator iter = bufferBindings.begin(); iter != bufferBindings.end(); ++iter) {
+			if (iter->bufferObject == bufferObject) {
+				return true;
+			}
+		}
+		for (std::vector<Command>::iterator iter = commands.begin(); iter != commands.end(); ++iter) {
+			if (((iter->type == COMMAND_UPDATE_BUFFER || iter->type == COMMAND_COPY_BUFFER) && iter->transfer.bufferObject == bufferObject) ||
+				(iter->type == COMMAND_DISPATCH && iter->dispatch.indirectBuffer == bufferObject)) {
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+template <>
+void CommandList::recordSetUniform<float>(ComputeShader *computeShader, Uniform *uniform, int index, float v1, float v2, float v3, float v4)
+{
+	Command command;
+	command.type = COMMAND_SET_UNIFORM;
+	command.setUniform.computeShader = computeShader;
+	command.setUniform.uniform = uniform;
+	command.setUniform.index = index;
+	command.setUniform.isInt = false;
+	command.setUniform.values.f[0] = v1;
+	command.setUniform.values.f[1] = v2;
+	command.setUniform.values.f[2] = v3;
+	command.setUniform.values.f[3] = v4;
+	commands.push_back(command);
+}
+
+template <>
+void CommandList::recordSetUniform<int>(ComputeShader *computeShader, Uniform *uniform, int index, int v1, int v2, int v3, int v4)
+{
+	Command command;
+	command.type = COMMAND_SET_UNIFORM;
+	command.setUniform.computeShader = computeShader;
+	command.setUniform.uniform = uniform;
+	command.setUniform.index = index;
+	command.setUniform.isInt = true;
+	command.setUniform.values.i[0] = v1;
+	command.setUniform.values.i[1] = v2;
+	command.setUniform.values.i[2] = v3;
+	command.setUniform.values.i[3] = v4;
+	commands.push_back(command);
+}
+
+typedef SlotMap<CommandList> CommandListMap;
+
+// Timer queries are reused in a ring, so that results can be collected once the GPU has caught up, without waiting for
+// it. Each one is a pair of timestamps, so that the GPU work can also be placed on the trace timeline. frame is the
+// value of GetRunTime when the query was issued, which AppGameKit only updates once per Sync.
+struct TimerQuery {
+	GLuint queryNames[2];
+	ComputeShader *computeShader;
+	CommandList *commandList;
+	float frame;
+};
+
+enum TraceEventType {
+	TRACE_EVENT_CPU_SPAN,
+	TRACE_EVENT_GPU_SPAN,
+	TRACE_EVENT_COUNTER,
+	TRACE_EVENT_FRAME
+};
+
+// Names are always string literals, so recording an event never allocates beyond the growth of the event list. Times
+// are in nanoseconds since the trace was started.
+struct TraceEvent {
+	char const *name;
+	TraceEventType type;
+	long long start;
+	long long duration;
+	long long value;
+};
+
+struct Tracer {
+	bool enabled;
+	std::chrono::steady_clock::time_point origin;
+	long long gpuOffset;
+	float frame;
+	long long bytesUploaded;
+	long long bytesDownloaded;
+	std::vector<TraceEvent> events;
+};
+
+struct Profiler {
+	bool enabled;
+	bool queriesCreated;
+	TimerQuery queries[NUM_TIMER_QUERIES];
+	unsigned int oldestQuery;
+	unsigned int numPendingQueries;
+	bool frameOpen;
+	float frame;
+	float frameTime;
+	float lastFrameTime;
+};
+
+// Hot reloading of shaders set up by SetShaderWatchInterval. Every interval frames, the files of every shader loaded from
+// a file are checked for changes, and shaders whose source has changed are compiled again in reloads, keyed by shader ID.
+// Shaders whose includes change while they are already being reloaded are listed in staleReloads, and reloaded again
+// once the reload under way has finished.
+struct ShaderWatch {
+	int interval;
+	int framesUntilCheck;
+	float frame;
+	PendingShaderMap reloads;
+	std::vector<unsigned int> staleReloads;
+};
+
+// Shadow copy of the GL state the plugin changes, so that unchanged bindings are not re-issued. AGK owns the current
+// program and the textures behind images, so those entries are only trusted for the duration of a batch. Only the plugin
+// uses shader storage buffer binding points, so those entries persist between batches.
+struct StateCache {
+	int batchDepth;
+	GLint agkProgramName;
+	GLuint programName;
+	GLuint imageTextures[MAX_IMAGE_BINDINGS];
+	GLuint storageBuffers[MAX_CACHED_STORAGE_BINDINGS];
+};
+
+ErrorMode errorMode = ERROR_MODE_REPORT_FIRST;
+ValidationLevel validationLevel = VALIDATION_LEVEL_ERRORS;
+PluginState pluginState = PLUGIN_STATE_UNINITIALISED;
+ComputerShaderMap computeShaders;
+PendingShaderMap pendingShaders;
+IncludeFileMap includeFileCache;
+ShaderVariantMap shaderVariants;
+BufferObjectMap bufferObjects;
+ReadbackMap readbacks;
+unsigned int dispatchSerial = 0;
+unsigned int barrierSerials[NUM_BARRIER_TYPES];
+ImageWriteSerialMap imageWriteSerials;
+bool imageExternalBarrierPending = false;
+CommandListMap commandLists;
+CommandList *recordingList = NULL;
+Profiler profiler = {};
+Tracer tracer;
+ShaderWatch shaderWatch;
+StateCache stateCache = { 0, 0, UNKNOWN_BINDING, {}, {} };
+char *shaderCacheFolder = NULL;
+unsigned long long driverHash = 0;
+unsigned int shaderCacheHits = 0;
+unsigned int shaderCacheMisses = 0;
+bool parallelShaderCompile = false;
+// glSpecializeShader, or its ARB equivalent, which takes the same arguments. NULL if SPIR-V shaders are not supported.
+PFNGLSPECIALIZESHADERPROC specializeShader = NULL;
+bool errorReported;
+
+void PluginError(char const *format, ...)
+{
+	if (ERROR_MODE_IGNORE == errorMode) {
+		return;
+	}
+
+	if (errorReported) {
+		if (ERROR_MODE_REPORT_FIRST == errorMode) {
+			return;
+		}
+	}
+	else {
+		errorReported = true;
+	}
+
+	char str[512];
+
+	va_list args;
+	va_start(args, format);
+
+	vsnprintf(str, 512, format, args);
+	agk::PluginError(str);
+
+	va_end(args);
+
+	if (ERROR_MODE_STOP == errorMode) {
+		exit(-1);
+	}
+}
+
+// With validation off, no error is ever reported back, so the driver is never asked to synchronise for glGetError.
+GLenum GetGLError()
+{
+	if (VALIDATION_LEVEL_OFF == validationLevel) {
+		return GL_NO_ERROR;
+	}
+	return glGetError();
+}
+
+long long TraceNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tracer.origin).count();
+}
+
+void AddTraceEvent(char const *name, TraceEventType type, long long start, long long duration, long long value = 0)
+{
+	if (tracer.events.size() >= MAX_TRACE_EVENTS) {
+		return;
+	}
+
+	float frame = agk::GetRunTime();
+	if (frame != tracer.frame) {
+		TraceEvent frameEvent = { "Frame", TRACE_EVENT_FRAME, TraceNow(), 0, 0 };
+		tracer.events.push_back(frameEvent);
+		tracer.frame = frame;
+	}
+
+	TraceEvent event = { name, type, start, duration, value };
+	tracer.events.push_back(event);
+}
+
+// Returns the start time to pass to TraceEnd, or -1 if tracing is off.
+long long TraceBegin()
+{
+	return tracer.enabled ? TraceNow() : -1;
+}
+
+void TraceEnd(char const *name, long long start)
+{
+	if (tracer.enabled && start >= 0) {
+		AddTraceEvent(name, TRACE_EVENT_CPU_SPAN, start, TraceNow() - start);
+	}
+}
+
+// Counts bytes copied between memblocks and buffers. The totals are recorded as counters, so the trace shows both the
+// rate and the size of each transfer.
+void TraceTransfer(bool upload, long long size)
+{
+	if (!tracer.enabled) {
+		return;
+	}
+
+	if (upload) {
+		tracer.bytesUploaded += size;
+		AddTraceEvent("BytesUploaded", TRACE_EVENT_COUNTER, TraceNow(), 0, tracer.bytesUploaded);
+	}
+	else {
+		tracer.bytesDownloaded += size;
+		AddTraceEvent("BytesDownloaded", TRACE_EVENT_COUNTER, TraceNow(), 0, tracer.bytesDownloaded);
+	}
+}
+
+// Records a span covering the rest of the enclosing scope. Used for every exported command.
+struct TraceScope {
+	char const *name;
+	long long start;
+
+	TraceScope(char const *name)
+	{
+		this->name = name;
+		start = TraceBegin();
+	}
+
+	~TraceScope()
+	{
+		TraceEnd(name, start);
+	}
+};
+
+#define TRACE_COMMAND() TraceScope traceScope(__FUNCTION__)
+
+void APIENTRY DebugMessageCallback(GLenum /* source */, GLenum type, GLuint /* id */, GLenum severity, GLsizei /* length */, GLchar const *message, void const * /* userParam */)
+{
+	if (type == GL_DEBUG_TYPE_ERROR || severity == GL_DEBUG_SEVERITY_HIGH) {
+		PluginError("OpenGL: %s", message);
+	}
+}
+
+bool CheckInit()
+{
+	switch (pluginState) {
 		case PLUGIN_STATE_UNINITIALISED: {
 #if defined(WIN32)
 			glCreateShader = (PFNGLCREATESHADERPROC)wglGetProcAddress("glCreateShader");
@@ -323,12 +1331,23 @@ bool CheckInit()
 			glGetProgramInfoLog = (PFNGLGETPROGRAMINFOLOGPROC)wglGetProcAddress("glGetProgramInfoLog");
 			glUseProgram = (PFNGLUSEPROGRAMPROC)wglGetProcAddress("glUseProgram");
 			glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)wglGetProcAddress("glDispatchCompute");
+			glDispatchComputeIndirect = (PFNGLDISPATCHCOMPUTEINDIRECTPROC)wglGetProcAddress("glDispatchComputeIndirect");
+			glGenQueries = (PFNGLGENQUERIESPROC)wglGetProcAddress("glGenQueries");
+			glDeleteQueries = (PFNGLDELETEQUERIESPROC)wglGetProcAddress("glDeleteQueries");
+			glBeginQuery = (PFNGLBEGINQUERYPROC)wglGetProcAddress("glBeginQuery");
+			glEndQuery = (PFNGLENDQUERYPROC)wglGetProcAddress("glEndQuery");
+			glGetQueryObjectiv = (PFNGLGETQUERYOBJECTIVPROC)wglGetProcAddress("glGetQueryObjectiv");
+			glGetQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VPROC)wglGetProcAddress("glGetQueryObjectui64v");
+			glQueryCounter = (PFNGLQUERYCOUNTERPROC)wglGetProcAddress("glQueryCounter");
 			glGetIntegeri_v = (PFNGLGETINTEGERI_VPROC)wglGetProcAddress("glGetIntegeri_v");
 			glBindImageTexture = (PFNGLBINDIMAGETEXTUREPROC)wglGetProcAddress("glBindImageTexture");
 			glUniform4f = (PFNGLUNIFORM4FPROC)wglGetProcAddress("glUniform4f");
 			glUniform4i = (PFNGLUNIFORM4IPROC)wglGetProcAddress("glUniform4i");
 			glGetUniformLocation = (PFNGLGETUNIFORMLOCATIONPROC)wglGetProcAddress("glGetUniformLocation");
 			glGetActiveUniform = (PFNGLGETACTIVEUNIFORMPROC)wglGetProcAddress("glGetActiveUniform");
+			glGetProgramResourceiv = (PFNGLGETPROGRAMRESOURCEIVPROC)wglGetProcAddress("glGetProgramResourceiv");
+			glGetProgramInterfaceiv = (PFNGLGETPROGRAMINTERFACEIVPROC)wglGetProcAddress("glGetProgramInterfaceiv");
+			glGetProgramResourceName = (PFNGLGETPROGRAMRESOURCENAMEPROC)wglGetProcAddress("glGetProgramResourceName");
 			glUniform1fv = (PFNGLUNIFORM1FVPROC)wglGetProcAddress("glUniform1fv");
 			glUniform2fv = (PFNGLUNIFORM2FVPROC)wglGetProcAddress("glUniform2fv");
 			glUniform3fv = (PFNGLUNIFORM3FVPROC)wglGetProcAddress("glUniform3fv");
@@ -342,9 +1361,30 @@ bool CheckInit()
 			glBindBuffer = (PFNGLBINDBUFFERPROC)wglGetProcAddress("glBindBuffer");
 			glBindBufferBase = (PFNGLBINDBUFFERBASEPROC)wglGetProcAddress("glBindBufferBase");
 			glBufferData = (PFNGLBUFFERDATAPROC)wglGetProcAddress("glBufferData");
+			glBufferSubData = (PFNGLBUFFERSUBDATAPROC)wglGetProcAddress("glBufferSubData");
 			glMapBuffer = (PFNGLMAPBUFFERPROC)wglGetProcAddress("glMapBuffer");
 			glUnmapBuffer = (PFNGLUNMAPBUFFERPROC)wglGetProcAddress("glUnmapBuffer");
 			glGetInteger64v = (PFNGLGETINTEGER64VPROC)wglGetProcAddress("glGetInteger64v");
+			glCopyBufferSubData = (PFNGLCOPYBUFFERSUBDATAPROC)wglGetProcAddress("glCopyBufferSubData");
+			glFenceSync = (PFNGLFENCESYNCPROC)wglGetProcAddress("glFenceSync");
+			glClientWaitSync = (PFNGLCLIENTWAITSYNCPROC)wglGetProcAddress("glClientWaitSync");
+			glDeleteSync = (PFNGLDELETESYNCPROC)wglGetProcAddress("glDeleteSync");
+			glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)wglGetProcAddress("glMemoryBarrier");
+			glBufferStorage = (PFNGLBUFFERSTORAGEPROC)wglGetProcAddress("glBufferStorage");
+			glMapBufferRange = (PFNGLMAPBUFFERRANGEPROC)wglGetProcAddress("glMapBufferRange");
+			glGetStringi = (PFNGLGETSTRINGIPROC)wglGetProcAddress("glGetStringi");
+			glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)wglGetProcAddress("glGetProgramBinary");
+			glProgramBinary = (PFNGLPROGRAMBINARYPROC)wglGetProcAddress("glProgramBinary");
+			glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)wglGetProcAddress("glProgramParameteri");
+			glGetActiveUniformsiv = (PFNGLGETACTIVEUNIFORMSIVPROC)wglGetProcAddress("glGetActiveUniformsiv");
+			glGetActiveUniformBlockiv = (PFNGLGETACTIVEUNIFORMBLOCKIVPROC)wglGetProcAddress("glGetActiveUniformBlockiv");
+			glGetActiveUniformBlockName = (PFNGLGETACTIVEUNIFORMBLOCKNAMEPROC)wglGetProcAddress("glGetActiveUniformBlockName");
+			glUniformBlockBinding = (PFNGLUNIFORMBLOCKBINDINGPROC)wglGetProcAddress("glUniformBlockBinding");
+			glDebugMessageCallback = (PFNGLDEBUGMESSAGECALLBACKPROC)wglGetProcAddress("glDebugMessageCallback");
+			glDebugMessageControl = (PFNGLDEBUGMESSAGECONTROLPROC)wglGetProcAddress("glDebugMessageControl");
+			glShaderBinary = (PFNGLSHADERBINARYPROC)wglGetProcAddress("glShaderBinary");
+			glSpecializeShader = (PFNGLSPECIALIZESHADERPROC)wglGetProcAddress("glSpecializeShader");
+			glSpecializeShaderARB = (PFNGLSPECIALIZESHADERARBPROC)wglGetProcAddress("glSpecializeShaderARB");
 			if (!glCreateShader || !glShaderSource || !glCompileShader ||
 				!glCreateProgram || !glAttachShader || !glLinkProgram ||
 				!glDeleteShader || !glGetShaderiv || !glGetShaderInfoLog ||
@@ -356,12 +1396,28 @@ bool CheckInit()
 				!glUniform1iv || !glUniform2iv || !glUniform3iv ||
 				!glUniform4iv || !glGenBuffers || !glDeleteBuffers ||
 				!glBindBuffer || !glBindBufferBase || !glBufferData ||
-				!glMapBuffer || !glUnmapBuffer || !glGetInteger64v) {
+				!glMapBuffer || !glUnmapBuffer || !glGetInteger64v ||
+				!glCopyBufferSubData || !glFenceSync || !glClientWaitSync ||
+				!glDeleteSync || !glMemoryBarrier || !glBufferStorage ||
+				!glMapBufferRange || !glBufferSubData || !glGetProgramBinary ||
+				!glProgramBinary || !glProgramParameteri || !glGetStringi ||
+				!glGetActiveUniformsiv || !glGetActiveUniformBlockiv || !glGetActiveUniformBlockName ||
+				!glUniformBlockBinding || !glDispatchComputeIndirect || !glGenQueries ||
+				!glDeleteQueries || !glBeginQuery || !glEndQuery ||
+				!glGetQueryObjectiv || !glGetQueryObjectui64v || !glQueryCounter ||
+				!glGetProgramResourceiv || !glGetProgramInterfaceiv || !glGetProgramResourceName) {
 				pluginState = PLUGIN_STATE_UNSUPPORTED;
 				return false;
 			}
 #elif defined(__linux__)
-			if (GLEW_OK != glewInit()) {
+			GLenum glewResult = glewInit();
+#if defined(GLEW_ERROR_NO_GLX_DISPLAY)
+			// A GLX build of GLEW still loads every entry point under an EGL context, but reports that GLX is missing.
+			if (GLEW_ERROR_NO_GLX_DISPLAY == glewResult) {
+				glewResult = GLEW_OK;
+			}
+#endif
+			if (GLEW_OK != glewResult) {
 				pluginState = PLUGIN_STATE_UNSUPPORTED;
 				return false;
 			}
@@ -378,304 +1434,2396 @@ bool CheckInit()
 			pluginState = PLUGIN_STATE_READY;
 			errorReported = false;
 
+			for (unsigned int i = 0; i < MAX_CACHED_STORAGE_BINDINGS; ++i) {
+				stateCache.storageBuffers[i] = UNKNOWN_BINDING;
+			}
+
+			// The ARB and KHR versions of the extension share the same completion status query.
+			bool spirvExtension = false;
+			GLint numExtensions = 0;
+			glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+			for (GLint i = 0; i < numExtensions; ++i) {
+				char const *extension = (char const *)glGetStringi(GL_EXTENSIONS, i);
+				if (extension && (strcmp(extension, "GL_KHR_parallel_shader_compile") == 0 ||
+					strcmp(extension, "GL_ARB_parallel_shader_compile") == 0)) {
+					parallelShaderCompile = true;
+				}
+				if (extension && strcmp(extension, "GL_ARB_gl_spirv") == 0) {
+					spirvExtension = true;
+				}
+			}
+
+			// SPIR-V is core from OpenGL 4.6, and available through ARB_gl_spirv before that.
+#if defined(WIN32) || defined(GL_VERSION_4_6)
+			if (majorVersion > 4 || (majorVersion == 4 && minorVersion >= 6)) {
+				specializeShader = glSpecializeShader;
+			}
+#endif
+#if defined(WIN32) || defined(GL_ARB_gl_spirv)
+			if (!specializeShader && spirvExtension) {
+				specializeShader = (PFNGLSPECIALIZESHADERPROC)glSpecializeShaderARB;
+			}
+#endif
+			if (!glShaderBinary) {
+				specializeShader = NULL;
+			}
+
+			return true;
+		}
+
+		case PLUGIN_STATE_READY:
 			return true;
+
+		case PLUGIN_STATE_UNSUPPORTED:
+			return false;
+	}
+
+	return false;
+}
+
+// Defines are inserted straight after the #version line, as nothing but comments may come before it, followed by a
+// #line directive so that line numbers in compile errors are the same as without them.
+char *GenerateFullShaderSource(char *sourceCode, std::string const &defines)
+{
+	char *c = sourceCode;
+	while (*c && (*c == '\n' || *c == ' ' || *c == '\t' || *c == '\r')) c++;
+	bool prependVersion = memcmp(c, "#version", 8) != 0;
+
+	// A prepended #version line pushes the first line of the source down to line 2.
+	char const *body = sourceCode;
+	int bodyLine = prependVersion ? 2 : 1;
+	if (!prependVersion) {
+		char const *versionEnd = strchr(c, '\n');
+		body = versionEnd ? versionEnd + 1 : c + strlen(c);
+		for (char const *l = sourceCode; l < body; ++l) {
+			if (*l == '\n') {
+				bodyLine += 1;
+			}
+		}
+	}
+
+	std::string lineDirective;
+	if (!defines.empty()) {
+		lineDirective = "#line " + std::to_string(bodyLine) + "\n";
+	}
+
+	size_t versionLength = prependVersion ? strlen(shaderVersion) : body - sourceCode;
+	size_t bodyLength = strlen(body);
+	char *sourceBuffer = (char *)malloc(versionLength + defines.size() + lineDirective.size() + bodyLength + 1);
+	char *out = sourceBuffer;
+	memcpy(out, prependVersion ? shaderVersion : sourceCode, versionLength);
+	out += versionLength;
+	memcpy(out, defines.data(), defines.size());
+	out += defines.size();
+	memcpy(out, lineDirective.data(), lineDirective.size());
+	out += lineDirective.size();
+	memcpy(out, body, bodyLength + 1);
+	return sourceBuffer;
+}
+
+// Turns a list of defines such as "NUM_NEIGHBOURS=8;USE_SHARED" into #define lines. A define without a value is given
+// the value 1, as with -D on a C compiler. The defines are sorted by name, so that the same set given in another order
+// produces the same source, and so the same variant.
+bool GenerateDefines(char const *defineList, std::string &defines)
+{
+	std::vector<std::pair<std::string, std::string>> parsed;
+	char const *c = defineList;
+	while (*c) {
+		char const *end = strchr(c, ';');
+		if (!end) {
+			end = c + strlen(c);
+		}
+		char const *nameStart = c;
+		while (nameStart < end && (*nameStart == ' ' || *nameStart == '\t')) nameStart++;
+		char const *nameEnd = nameStart;
+		while (nameEnd < end && (isalnum((unsigned char)*nameEnd) || *nameEnd == '_')) nameEnd++;
+		char const *valueStart = nameEnd;
+		while (valueStart < end && (*valueStart == ' ' || *valueStart == '\t')) valueStart++;
+		char const *valueEnd = end;
+		while (valueEnd > valueStart && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) valueEnd--;
+
+		if (valueStart == end && nameStart == end) {
+			// Empty entries, such as from a trailing semicolon, are skipped.
+		}
+		else if (nameEnd == nameStart || isdigit((unsigned char)*nameStart) || (valueStart < end && *valueStart != '=')) {
+			PluginError("Invalid define '%.*s'. Defines must be given as NAME or NAME=value, separated by semicolons.", (int)(end - c), c);
+			return false;
+		}
+		else {
+			std::string value = "1";
+			if (valueStart < end) {
+				valueStart++;
+				while (valueStart < valueEnd && (*valueStart == ' ' || *valueStart == '\t')) valueStart++;
+				value = std::string(valueStart, valueEnd);
+			}
+			parsed.push_back(std::make_pair(std::string(nameStart, nameEnd), value));
+		}
+		c = *end ? end + 1 : end;
+	}
+
+	std::sort(parsed.begin(), parsed.end(), [](std::pair<std::string, std::string> const &a, std::pair<std::string, std::string> const &b) {
+		return a.first < b.first;
+	});
+	for (size_t i = 0; i < parsed.size(); ++i) {
+		if (i > 0 && parsed[i].first == parsed[i - 1].first) {
+			PluginError("Define '%s' is given more than once.", parsed[i].first.c_str());
+			return false;
+		}
+		defines += "#define " + parsed[i].first + " " + parsed[i].second + "\n";
+	}
+	return true;
+}
+
+unsigned long long HashBytes(void const *data, size_t size, unsigned long long hash = 14695981039346656037ULL)
+{
+	unsigned char const *bytes = (unsigned char const *)data;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+unsigned long long HashString(char const *str, unsigned long long hash = 14695981039346656037ULL)
+{
+	// The terminator is hashed too so that "ab" + "c" and "a" + "bc" produce different keys.
+	return HashBytes(str ? str : "", str ? strlen(str) + 1 : 1, hash);
+}
+
+// Reads the whole file in one go and converts Windows and old Mac line endings to '\n' while copying it out, so the cost
+// is linear in the size of the file however many lines it has.
+char *ReadShaderFile(char const *shaderFile)
+{
+	if (!agk::GetFileExists(shaderFile)) {
+		PluginError("Unable to load shader file '%s'.", shaderFile);
+		return NULL;
+	}
+
+	long long readStart = TraceBegin();
+	unsigned int memblockID = agk::CreateMemblockFromFile(shaderFile);
+	TraceEnd("ReadFile", readStart);
+	unsigned char *data = memblockID ? agk::GetMemblockPtr(memblockID) : NULL;
+	if (!data) {
+		PluginError("Unable to read shader file '%s'.", shaderFile);
+		return NULL;
+	}
+
+	int size = agk::GetMemblockSize(memblockID);
+	char *sourceCode = (char *)malloc(size + 1);
+	char *out = sourceCode;
+	for (int i = 0; i < size; ++i) {
+		if (data[i] == '\r') {
+			*out++ = '\n';
+			if (i + 1 < size && data[i + 1] == '\n') {
+				++i;
+			}
+		}
+		else {
+			*out++ = (char)data[i];
+		}
+	}
+	*out = '\0';
+	agk::DeleteMemblock(memblockID);
+	return sourceCode;
+}
+
+// Include paths are relative to the file containing the #include, as in C, unless they are raw paths or start from the
+// root of the media folder. Includes in shaders loaded from strings are relative to the media folder.
+std::string IncludePath(char const *includingFile, std::string const &name)
+{
+	if (!includingFile || name.compare(0, 4, "raw:") == 0 || name[0] == '/' || name[0] == '\\') {
+		return name;
+	}
+
+	size_t folderLength = 0;
+	for (char const *c = includingFile; *c; ++c) {
+		if (*c == '/' || *c == '\\') {
+			folderLength = c - includingFile + 1;
+		}
+	}
+	return std::string(includingFile, folderLength) + name;
+}
+
+// Finds every #include "file" line in source. Only whole lines are recognised, so an #include in a block comment is
+// still followed. #line directives are obeyed, so that the line recorded for each #include is the one the compiler
+// would report.
+bool FindIncludes(char const *source, char const *sourceFile, std::vector<IncludeDirective> &directives)
+{
+	int line = 1;
+	for (char const *lineStart = source; *lineStart; ++line) {
+		char const *lineEnd = strchr(lineStart, '\n');
+		if (!lineEnd) {
+			lineEnd = lineStart + strlen(lineStart);
+		}
+
+		char const *c = lineStart;
+		while (c < lineEnd && (*c == ' ' || *c == '\t')) c++;
+		if (c < lineEnd && *c == '#') {
+			c++;
+			while (c < lineEnd && (*c == ' ' || *c == '\t')) c++;
+			if (lineEnd - c > 5 && memcmp(c, "line", 4) == 0 && (c[4] == ' ' || c[4] == '\t')) {
+				line = atoi(c + 5) - 1;
+			}
+			else if (lineEnd - c >= 7 && memcmp(c, "include", 7) == 0) {
+				c += 7;
+				while (c < lineEnd && (*c == ' ' || *c == '\t')) c++;
+				char const *nameEnd = NULL;
+				if (c < lineEnd && *c == '"') {
+					nameEnd = (char const *)memchr(c + 1, '"', lineEnd - c - 1);
+				}
+				if (!nameEnd || nameEnd == c + 1) {
+					PluginError("Invalid #include on line %d of %s%s%s. Expected a file name in double quotes.", line,
+						sourceFile ? "'" : "", sourceFile ? sourceFile : "shader source", sourceFile ? "'" : "");
+					return false;
+				}
+
+				IncludeDirective directive;
+				directive.start = lineStart - source;
+				directive.end = lineEnd - source;
+				directive.line = line;
+				directive.path = IncludePath(sourceFile, std::string(c + 1, nameEnd));
+				directives.push_back(directive);
+			}
+		}
+		lineStart = *lineEnd ? lineEnd + 1 : lineEnd;
+	}
+	return true;
+}
+
+IncludeFile *LoadIncludeFile(std::string const &path)
+{
+	IncludeFileMap::iterator iter = includeFileCache.find(path);
+	if (iter != includeFileCache.end()) {
+		return iter->second;
+	}
+
+	char *source = ReadShaderFile(path.c_str());
+	if (!source) {
+		return NULL;
+	}
+
+	IncludeFile *includeFile = new IncludeFile();
+	includeFile->source = source;
+	free(source);
+	if (!FindIncludes(includeFile->source.c_str(), path.c_str(), includeFile->directives)) {
+		delete includeFile;
+		return NULL;
+	}
+	includeFile->hash = HashString(includeFile->source.c_str());
+	includeFileCache[path] = includeFile;
+	return includeFile;
+}
+
+// Appends source to expandedSource with each #include replaced by the file it names, and adds the path of every file
+// included, directly or not, to includes. A file is only inserted the first time it is included, so headers need no
+// include guards. #line directives keep compile errors pointing at the right line, with each included file numbered as
+// its own source string, starting from 1, in the order it was first included.
+bool ExpandIncludes(char const *source, std::vector<IncludeDirective> const &directives, int sourceString,
+	std::string &expandedSource, std::vector<std::string> &includes)
+{
+	size_t copied = 0;
+	for (size_t i = 0; i < directives.size(); ++i) {
+		IncludeDirective const &directive = directives[i];
+		expandedSource.append(source + copied, directive.start - copied);
+		copied = directive.end;
+		if (std::find(includes.begin(), includes.end(), directive.path) != includes.end()) {
+			continue;
+		}
+
+		IncludeFile *includeFile = LoadIncludeFile(directive.path);
+		if (!includeFile) {
+			return false;
+		}
+		includes.push_back(directive.path);
+		int includeString = (int)includes.size();
+		expandedSource += "#line 1 " + std::to_string(includeString) + "\n";
+		if (!ExpandIncludes(includeFile->source.c_str(), includeFile->directives, includeString, expandedSource, includes)) {
+			return false;
+		}
+		if (expandedSource.back() != '\n') {
+			expandedSource += '\n';
+		}
+		// The newline that ended the #include line follows, so the next line is the one after the #include.
+		expandedSource += "#line " + std::to_string(directive.line + 1) + " " + std::to_string(sourceString);
+	}
+	expandedSource.append(source + copied);
+	return true;
+}
+
+// A binary is only valid for the driver that produced it, so the driver identity forms part of every cache key. Included
+// files are covered by their paths and the hashes taken when they were read, so a change to one only affects the
+// shaders that include it.
+unsigned long long ShaderCacheKey(char const *fullShaderSource, std::vector<std::string> const &includes)
+{
+	if (!driverHash) {
+		driverHash = HashString((char const *)glGetString(GL_VENDOR));
+		driverHash = HashString((char const *)glGetString(GL_RENDERER), driverHash);
+		driverHash = HashString((char const *)glGetString(GL_VERSION), driverHash);
+	}
+	unsigned long long key = HashString(fullShaderSource, driverHash);
+	for (size_t i = 0; i < includes.size(); ++i) {
+		unsigned long long includeHash = includeFileCache[includes[i]]->hash;
+		key = HashString(includes[i].c_str(), key);
+		key = HashBytes(&includeHash, sizeof(includeHash), key);
+	}
+	return key;
+}
+
+void ShaderCachePath(unsigned long long key, char *path, size_t pathSize)
+{
+	snprintf(path, pathSize, "%s/%016llx.bin", shaderCacheFolder, key);
+}
+
+GLuint LoadCachedProgram(unsigned long long key)
+{
+	char path[512];
+	ShaderCachePath(key, path, sizeof(path));
+	if (!agk::GetFileExists(path)) {
+		return 0;
+	}
+
+	unsigned int memblockID = agk::CreateMemblockFromFile(path);
+	if (!memblockID) {
+		return 0;
+	}
+
+	unsigned char *data = agk::GetMemblockPtr(memblockID);
+	int size = agk::GetMemblockSize(memblockID);
+	GLuint programName = 0;
+	if (data && size > SHADER_CACHE_HEADER_SIZE) {
+		unsigned int header[4];
+		long long copyStart = TraceBegin();
+		memcpy(header, data, sizeof(header));
+		TraceEnd("Memcpy", copyStart);
+		if (header[0] == SHADER_CACHE_MAGIC && header[1] == SHADER_CACHE_VERSION &&
+			header[3] <= (unsigned int)(size - SHADER_CACHE_HEADER_SIZE)) {
+			programName = glCreateProgram();
+			long long programBinaryStart = TraceBegin();
+			glProgramBinary(programName, header[2], data + SHADER_CACHE_HEADER_SIZE, header[3]);
+			TraceEnd("ProgramBinary", programBinaryStart);
+			// Drivers reject binaries from older versions of themselves with an error, which must not leak into
+			// the checks of the source compile that follows.
+			GetGLError();
+
+			GLint linkStatus = GL_FALSE;
+			glGetProgramiv(programName, GL_LINK_STATUS, &linkStatus);
+			if (linkStatus != GL_TRUE) {
+				glDeleteProgram(programName);
+				programName = 0;
+			}
+		}
+	}
+	agk::DeleteMemblock(memblockID);
+
+	if (!programName) {
+		agk::DeleteFile(path);
+	}
+	return programName;
+}
+
+void SaveCachedProgram(unsigned long long key, GLuint programName)
+{
+	GLint binaryLength = 0;
+	glGetProgramiv(programName, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+	if (binaryLength <= 0) {
+		return;
+	}
+
+	unsigned int memblockID = agk::CreateMemblock(SHADER_CACHE_HEADER_SIZE + binaryLength);
+	unsigned char *data = agk::GetMemblockPtr(memblockID);
+
+	GLsizei written = 0;
+	GLenum binaryFormat = 0;
+	glGetProgramBinary(programName, binaryLength, &written, &binaryFormat, data + SHADER_CACHE_HEADER_SIZE);
+	if (GetGLError() == GL_NO_ERROR && written > 0) {
+		unsigned int header[4] = { SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, binaryFormat, (unsigned int)written };
+		memcpy(data, header, sizeof(header));
+
+		char path[512];
+		ShaderCachePath(key, path, sizeof(path));
+		agk::CreateFileFromMemblock(path, memblockID);
+	}
+	agk::DeleteMemblock(memblockID);
+}
+
+// Creates a program from the shader and issues the link without asking for the result. The shader is deleted if the
+// program cannot be created.
+GLuint StartLinkProgram(GLuint shaderName, bool retrievable)
+{
+	GLuint programName = glCreateProgram();
+	if (!programName) {
+		PluginError("Failed to create shader program.");
+		glDeleteShader(shaderName);
+		return 0;
+	}
+
+	glAttachShader(programName, shaderName);
+	switch (GetGLError()) {
+		case GL_INVALID_VALUE: {
+			PluginError("Failed to attach shader. Invalid shader or program name.");
+			glDeleteShader(shaderName);
+			glDeleteProgram(programName);
+			return 0;
+		}
+		case GL_INVALID_OPERATION: {
+			PluginError("Failed to attach shader. Non-program or non-shader object used, shader already attached, or shader of same type already attached.");
+			glDeleteShader(shaderName);
+			glDeleteProgram(programName);
+			return 0;
+		}
+	}
+
+	if (retrievable) {
+		glProgramParameteri(programName, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	// Linking a shader that failed to compile simply fails to link, so the compile status can be checked afterwards.
+	long long linkStart = TraceBegin();
+	glLinkProgram(programName);
+	TraceEnd("Link", linkStart);
+
+	return programName;
+}
+
+// Issues the compile and link without asking for either result, as querying the status forces the driver to finish
+// the work on the calling thread. FinishCompileProgram must be called on the returned program before it is used.
+GLuint StartCompileProgram(char *fullShaderSource, bool retrievable, GLuint *shaderNameOut)
+{
+	GLuint shaderName = glCreateShader(GL_COMPUTE_SHADER);
+	if (!shaderName) {
+		switch (GetGLError()) {
+			case GL_INVALID_ENUM: {
+				PluginError("Failed to create computer shader. Invalid shader type.");
+				break;
+			}
+			default: {
+				PluginError("Failed to create computer shader. Unknown error.");
+				break;
+			}
+		}
+		return 0;
+	}
+
+	glShaderSource(shaderName, 1, &fullShaderSource, NULL);
+	switch (GetGLError()) {
+		case GL_INVALID_VALUE: {
+			PluginError("Failed to load shader source. Invalid shader name.");
+			glDeleteShader(shaderName);
+			return 0;
+		}
+		case GL_INVALID_OPERATION: {
+			PluginError("Failed to load shader source. Non-shader object provided as shader.");
+			glDeleteShader(shaderName);
+			return 0;
+		}
+	}
+
+	long long compileStart = TraceBegin();
+	glCompileShader(shaderName);
+	TraceEnd("Compile", compileStart);
+	switch (GetGLError()) {
+		case GL_INVALID_VALUE: {
+			PluginError("Failed to load shader source. Invalid shader name.");
+			glDeleteShader(shaderName);
+			return 0;
+		}
+		case GL_INVALID_OPERATION: {
+			PluginError("Failed to load shader source. Non-shader object provided as shader.");
+			glDeleteShader(shaderName);
+			return 0;
+		}
+	}
+
+	GLuint programName = StartLinkProgram(shaderName, retrievable);
+	if (!programName) {
+		return 0;
+	}
+
+	*shaderNameOut = shaderName;
+	return programName;
+}
+
+// Hands a SPIR-V module to the driver and specializes its entry point, which takes the place of compiling GLSL source.
+// Some drivers report a missing entry point or constant straight away, and others only when FinishCompileProgram asks
+// whether the shader compiled.
+GLuint StartSpecializeShader(unsigned char const *module, int moduleSize, char const *entryPoint,
+	std::vector<GLuint> const &constantIndices, std::vector<GLuint> const &constantValues)
+{
+	GLuint shaderName = glCreateShader(GL_COMPUTE_SHADER);
+	if (!shaderName) {
+		PluginError("Failed to create computer shader. Unknown error.");
+		return 0;
+	}
+
+	glShaderBinary(1, &shaderName, GL_SHADER_BINARY_FORMAT_SPIR_V, module, moduleSize);
+	if (GetGLError() != GL_NO_ERROR) {
+		PluginError("Failed to load SPIR-V module. The driver did not accept it.");
+		glDeleteShader(shaderName);
+		return 0;
+	}
+
+	long long specializeStart = TraceBegin();
+	specializeShader(shaderName, entryPoint, (GLuint)constantIndices.size(),
+		constantIndices.empty() ? NULL : &constantIndices[0], constantValues.empty() ? NULL : &constantValues[0]);
+	TraceEnd("Specialize", specializeStart);
+	switch (GetGLError()) {
+		case GL_NO_ERROR: {
+			return shaderName;
+		}
+		case GL_INVALID_VALUE: {
+			PluginError("Failed to specialize SPIR-V module. Entry point '%s' or one of the specialization constant IDs is not in the module.", entryPoint);
+			break;
+		}
+		default: {
+			PluginError("Failed to specialize SPIR-V module. Unknown error.");
+			break;
+		}
+	}
+	glDeleteShader(shaderName);
+	return 0;
+}
+
+GLuint FinishCompileProgram(GLuint shaderName, GLuint programName)
+{
+	GLint compileStatus;
+	glGetShaderiv(shaderName, GL_COMPILE_STATUS, &compileStatus);
+	if (compileStatus != GL_TRUE) {
+		GLint logLen;
+		glGetShaderiv(shaderName, GL_INFO_LOG_LENGTH, &logLen);
+		char *infoLogBuffer = (char *)malloc(logLen);
+		glGetShaderInfoLog(shaderName, logLen, NULL, infoLogBuffer);
+		PluginError("%s", infoLogBuffer);
+		free(infoLogBuffer);
+		glDeleteShader(shaderName);
+		glDeleteProgram(programName);
+		return 0;
+	}
+
+	GLint linkStatus;
+	glGetProgramiv(programName, GL_LINK_STATUS, &linkStatus);
+	if (linkStatus != GL_TRUE) {
+		GLint logLen;
+		glGetProgramiv(programName, GL_INFO_LOG_LENGTH, &logLen);
+		char *infoLogBuffer = (char *)malloc(logLen);
+		glGetProgramInfoLog(programName, logLen, NULL, infoLogBuffer);
+		PluginError("%s", infoLogBuffer);
+		free(infoLogBuffer);
+		glDeleteShader(shaderName);
+		glDeleteProgram(programName);
+		return 0;
+	}
+
+	glDeleteShader(shaderName);
+	return programName;
+}
+
+GLuint CompileProgram(char *fullShaderSource, bool retrievable)
+{
+	GLuint shaderName;
+	GLuint programName = StartCompileProgram(fullShaderSource, retrievable, &shaderName);
+	if (!programName) {
+		return 0;
+	}
+	return FinishCompileProgram(shaderName, programName);
+}
+
+// Without parallel compile support there is no way to ask whether the driver has finished, so the check is deferred
+// until the app asks for the status, and the driver is waited on then.
+bool IsPendingShaderComplete(PendingShader *pendingShader)
+{
+	if (pendingShader->failed || !parallelShaderCompile) {
+		return true;
+	}
+
+	GLint complete = GL_TRUE;
+	glGetProgramiv(pendingShader->programName, GL_COMPLETION_STATUS_KHR, &complete);
+	return complete == GL_TRUE;
+}
+
+void FinishPendingShader(PendingShaderMap::iterator iter)
+{
+	PendingShader *pendingShader = iter->second;
+	if (pendingShader->failed) {
+		return;
+	}
+
+	GLuint programName = FinishCompileProgram(pendingShader->shaderName, pendingShader->programName);
+	if (!programName) {
+		pendingShader->failed = true;
+		return;
+	}
+
+	if (pendingShader->saveToCache && shaderCacheFolder) {
+		SaveCachedProgram(pendingShader->cacheKey, programName);
+	}
+
+	ComputeShader *computeShader = new ComputeShader(programName);
+	computeShader->origin = pendingShader->origin;
+	computeShader->findReadOnlyBindings();
+	computeShaders.fill(iter->first, computeShader);
+	delete pendingShader;
+	pendingShaders.erase(iter);
+}
+
+// Shaders still compiling are waited on when first used, in the same way that OpenGL itself would.
+void FinishPendingShader(unsigned int shaderID)
+{
+	PendingShaderMap::iterator iter = pendingShaders.find(shaderID);
+	if (iter != pendingShaders.end()) {
+		FinishPendingShader(iter);
+	}
+}
+
+// Returns 1 if the shader is ready, 0 if it is still compiling, and -1 if it failed or does not exist.
+int GetShaderStatus(unsigned int shaderID)
+{
+	if (computeShaders.find(shaderID) != computeShaders.end()) {
+		return 1;
+	}
+
+	PendingShaderMap::iterator iter = pendingShaders.find(shaderID);
+	if (iter == pendingShaders.end()) {
+		PluginError("Attempting to get status of unknown shader %u.", shaderID);
+		return -1;
+	}
+
+	if (!IsPendingShaderComplete(iter->second)) {
+		return 0;
+	}
+
+	FinishPendingShader(iter);
+	return computeShaders.find(shaderID) != computeShaders.end() ? 1 : -1;
+}
+
+// Finds the names of the shader storage blocks that the source declares readonly, so that running the shader isn't
+// taken to write to the buffers bound to them. Only qualifiers on the block itself are seen, so a block whose members are
+// each declared readonly is still taken to be written.
+void FindReadOnlyBlocks(char const *source, std::vector<std::string> &blockNames)
+{
+	blockNames.clear();
+	bool readOnly = false;
+	bool storageBlock = false;
+	std::string blockName;
+	char const *c = source;
+	while (*c) {
+		if (c[0] == '/' && c[1] == '*') {
+			char const *end = strstr(c + 2, "*/");
+			c = end ? end + 2 : c + strlen(c);
+		}
+		else if ((c[0] == '/' && c[1] == '/') || c[0] == '#') {
+			while (*c && *c != '\n') {
+				++c;
+			}
+		}
+		else if (isalpha((unsigned char)*c) || *c == '_') {
+			char const *start = c;
+			while (isalnum((unsigned char)*c) || *c == '_') {
+				++c;
+			}
+			std::string identifier(start, c);
+			if (identifier == "readonly") {
+				readOnly = true;
+			}
+			else if (identifier == "buffer") {
+				storageBlock = true;
+			}
+			else if (storageBlock) {
+				blockName = identifier;
+			}
+		}
+		else {
+			// Each declaration ends at one of these, and a block's name is the last identifier before its brace.
+			if (*c == '{' && storageBlock && readOnly && !blockName.empty()) {
+				blockNames.push_back(blockName);
+			}
+			if (*c == ';' || *c == '{' || *c == '}') {
+				readOnly = false;
+				storageBlock = false;
+				blockName.clear();
+			}
+			++c;
+		}
+	}
+}
+
+// Builds the source that is compiled for a shader, with its defines added and its includes expanded, and its cache key.
+// shaderFile is the file the source was read from, or NULL if it was passed in as a string.
+bool PrepareShaderSource(char *shaderSource, char const *shaderFile, char const *defineList, std::string &compileSource,
+	std::vector<std::string> &includes, unsigned long long *cacheKey)
+{
+	std::string defines;
+	if (defineList && !GenerateDefines(defineList, defines)) {
+		return false;
+	}
+	char *fullShaderSource = GenerateFullShaderSource(shaderSource, defines);
+
+	std::vector<IncludeDirective> directives;
+	if (!FindIncludes(fullShaderSource, shaderFile, directives) ||
+		!ExpandIncludes(fullShaderSource, directives, 0, compileSource, includes)) {
+		free(fullShaderSource);
+		return false;
+	}
+
+	*cacheKey = ShaderCacheKey(fullShaderSource, includes);
+	free(fullShaderSource);
+	return true;
+}
+
+// defineList is only given for variants, which share their programs; see ShaderVariant.
+unsigned int LoadShaderSource(char *shaderSource, char const *shaderFile, char const *defineList, bool async)
+{
+	ShaderOrigin origin;
+	std::string compileSource;
+	if (!PrepareShaderSource(shaderSource, shaderFile, defineList, compileSource, origin.includes, &origin.sourceKey)) {
+		return 0;
+	}
+	FindReadOnlyBlocks(compileSource.c_str(), origin.readOnlyBlocks);
+	unsigned long long cacheKey = origin.sourceKey;
+	origin.fileHash = 0;
+	if (shaderFile) {
+		origin.sourceFile = shaderFile;
+		origin.defineList = defineList ? defineList : "";
+		origin.fileHash = HashString(shaderSource);
+	}
+
+	GLuint programName = 0;
+	ShaderVariant *variant = NULL;
+	if (defineList) {
+		ShaderVariantMap::iterator variantIter = shaderVariants.find(cacheKey);
+		if (variantIter != shaderVariants.end()) {
+			variant = variantIter->second;
+			programName = variant->programName;
+		}
+	}
+	if (!programName && shaderCacheFolder) {
+		programName = LoadCachedProgram(cacheKey);
+		if (programName) {
+			shaderCacheHits += 1;
+		}
+		else {
+			shaderCacheMisses += 1;
+		}
+	}
+
+	if (!programName && async) {
+		GLuint shaderName;
+		programName = StartCompileProgram(&compileSource[0], shaderCacheFolder != NULL, &shaderName);
+		if (!programName) {
+			return 0;
+		}
+
+		PendingShader *pendingShader = new PendingShader();
+		pendingShader->shaderName = shaderName;
+		pendingShader->programName = programName;
+		pendingShader->cacheKey = cacheKey;
+		pendingShader->saveToCache = shaderCacheFolder != NULL;
+		pendingShader->failed = false;
+		pendingShader->origin = origin;
+
+		// The ID is reserved now, so that it is the one the shader has once compiled.
+		unsigned int id = computeShaders.reserve();
+		if (!id) {
+			glDeleteShader(shaderName);
+			glDeleteProgram(programName);
+			delete pendingShader;
+			return 0;
+		}
+		pendingShaders[id] = pendingShader;
+		return id;
+	}
+
+	if (!programName) {
+		programName = CompileProgram(&compileSource[0], shaderCacheFolder != NULL);
+		if (programName && shaderCacheFolder) {
+			SaveCachedProgram(cacheKey, programName);
+		}
+	}
+
+	if (!programName) {
+		return 0;
+	}
+
+	if (defineList && !variant) {
+		variant = new ShaderVariant();
+		variant->programName = programName;
+		variant->uniformOwner = NULL;
+		shaderVariants[cacheKey] = variant;
+	}
+
+	ComputeShader *computeShader = new ComputeShader(programName);
+	computeShader->origin = origin;
+	computeShader->variant = variant;
+	computeShader->findReadOnlyBindings();
+	unsigned int id = computeShaders.insert(computeShader);
+	if (!id) {
+		delete computeShader;
+	}
+	return id;
+}
+
+// SPIR-V modules are already compiled, so the driver only has to specialize and link them. These programs are not saved
+// to the shader cache, as that would save little, and Mesa crashes when asked for the binary of one. Shaders loaded this
+// way have no source to watch, so they are never reloaded.
+unsigned int LoadShaderSPIRV(char const *shaderFile, char const *entryPoint, unsigned int specConstantsMemblockID)
+{
+	if (!CheckInit()) {
+		return 0;
+	}
+
+	if (!specializeShader) {
+		PluginError("Failed to load SPIR-V shader '%s'. The driver does not support SPIR-V shaders.", shaderFile);
+		return 0;
+	}
+
+	// The constants are given as pairs of unsigned ints, the constant ID followed by its value, which may be an int or
+	// the bits of a float.
+	std::vector<GLuint> constantIndices;
+	std::vector<GLuint> constantValues;
+	if (specConstantsMemblockID) {
+		unsigned char *constants = agk::GetMemblockPtr(specConstantsMemblockID);
+		if (!constants) {
+			PluginError("Failed to load SPIR-V shader '%s'. Memblock %u does not exist.", shaderFile, specConstantsMemblockID);
+			return 0;
+		}
+		int size = agk::GetMemblockSize(specConstantsMemblockID);
+		if (size % (2 * sizeof(GLuint)) != 0) {
+			PluginError("Failed to load SPIR-V shader '%s'. Memblock %u is %d bytes, which is not a whole number of constant ID and value pairs.", shaderFile, specConstantsMemblockID, size);
+			return 0;
+		}
+		for (int i = 0; i < size; i += 2 * sizeof(GLuint)) {
+			GLuint pair[2];
+			memcpy(pair, constants + i, sizeof(pair));
+			constantIndices.push_back(pair[0]);
+			constantValues.push_back(pair[1]);
+		}
+	}
+
+	if (!agk::GetFileExists(shaderFile)) {
+		PluginError("Unable to load shader file '%s'.", shaderFile);
+		return 0;
+	}
+
+	long long readStart = TraceBegin();
+	unsigned int memblockID = agk::CreateMemblockFromFile(shaderFile);
+	TraceEnd("ReadFile", readStart);
+	unsigned char *module = memblockID ? agk::GetMemblockPtr(memblockID) : NULL;
+	if (!module) {
+		PluginError("Unable to read shader file '%s'.", shaderFile);
+		return 0;
+	}
+
+	int moduleSize = agk::GetMemblockSize(memblockID);
+	GLuint magic = 0;
+	if (moduleSize >= SPIRV_HEADER_SIZE) {
+		memcpy(&magic, module, sizeof(magic));
+	}
+	if (moduleSize % sizeof(GLuint) != 0 || magic != SPIRV_MAGIC) {
+		PluginError("Failed to load SPIR-V shader '%s'. The file is not a SPIR-V module.", shaderFile);
+		agk::DeleteMemblock(memblockID);
+		return 0;
+	}
+
+	GLuint shaderName = StartSpecializeShader(module, moduleSize, entryPoint, constantIndices, constantValues);
+	agk::DeleteMemblock(memblockID);
+	GLuint programName = shaderName ? StartLinkProgram(shaderName, false) : 0;
+	if (programName) {
+		programName = FinishCompileProgram(shaderName, programName);
+	}
+
+	if (!programName) {
+		return 0;
+	}
+
+	ComputeShader *computeShader = new ComputeShader(programName);
+	computeShader->origin.fileHash = 0;
+	computeShader->origin.sourceKey = 0;
+	unsigned int id = computeShaders.insert(computeShader);
+	if (!id) {
+		delete computeShader;
+	}
+	return id;
+}
+
+unsigned int CreateBuffer(GLsizei size, void *data)
+{
+	GLuint bufferName;
+	glGenBuffers(1, &bufferName);
+	if (GetGLError() == GL_INVALID_VALUE) {
+		PluginError("Failed to create buffer.");
+		return 0;
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferName);
+	switch (GetGLError()) {
+		case GL_INVALID_ENUM: {
+			PluginError("Failed to create buffer. Invalid target.");
+			return 0;
+		}
+		case GL_INVALID_VALUE: {
+			PluginError("Failed to create buffer. Unknown buffer name.");
+			return 0;
+		}
+	}
+
+	long long uploadStart = TraceBegin();
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STATIC_COPY);
+	TraceEnd("Upload", uploadStart);
+	if (data) {
+		TraceTransfer(true, size);
+	}
+	switch (GetGLError()) {
+		case GL_INVALID_ENUM: {
+			PluginError("Failed to create buffer. Invalid target or usage.");
+			return 0;
+		}
+		case GL_INVALID_VALUE: {
+			PluginError("Failed to create buffer. Invalid memblock size.");
+			return 0;
+		}
+		case GL_INVALID_OPERATION: {
+			PluginError("Failed to create buffer. Unknown or immutable buffer object used.");
+			return 0;
+		}
+		case GL_OUT_OF_MEMORY: {
+			PluginError("Failed to create buffer. Insufficient memory available.");
+			return 0;
+		}
+	}
+
+	BufferObject *bufferObject = new BufferObject(bufferName, size);
+	unsigned int id = bufferObjects.insert(bufferObject);
+	if (!id) {
+		delete bufferObject;
+	}
+	return id;
+}
+
+// Resources record the serial of the last dispatch that had them bound, which is conservatively treated as a write. A
+// barrier type only needs issuing if that write happened after the barrier type was last issued.
+GLbitfield RequiredBarrier(unsigned int writeSerial, BarrierType type)
+{
+	return writeSerial > barrierSerials[type] ? barrierBits[type] : 0;
+}
+
+void IssueBarriers(GLbitfield bits)
+{
+	if (!bits) {
+		return;
+	}
+
+	glMemoryBarrier(bits);
+	for (int type = 0; type < NUM_BARRIER_TYPES; ++type) {
+		if (bits & barrierBits[type]) {
+			barrierSerials[type] = dispatchSerial;
+		}
+	}
+}
+
+void SyncBufferForTransfer(BufferObject *bufferObject)
+{
+	IssueBarriers(RequiredBarrier(bufferObject->writeSerial, BARRIER_BUFFER_UPDATE));
+}
+
+void BeginStateBatch()
+{
+	if (stateCache.batchDepth++ > 0) {
+		return;
+	}
+
+	glGetIntegerv(GL_CURRENT_PROGRAM, &stateCache.agkProgramName);
+	stateCache.programName = (GLuint)stateCache.agkProgramName;
+	for (unsigned int i = 0; i < MAX_IMAGE_BINDINGS; ++i) {
+		stateCache.imageTextures[i] = UNKNOWN_BINDING;
+	}
+}
+
+void EndStateBatch()
+{
+	if (--stateCache.batchDepth > 0) {
+		return;
+	}
+
+	if (stateCache.programName != (GLuint)stateCache.agkProgramName) {
+		glUseProgram(stateCache.agkProgramName);
+	}
+	stateCache.programName = UNKNOWN_BINDING;
+
+	// AGK can't use the images written in the batch until it has ended, so a single barrier covers all of them.
+	if (imageExternalBarrierPending) {
+		glMemoryBarrier(imageExternalBarrierBits);
+		imageExternalBarrierPending = false;
+	}
+}
+
+GLuint *CachedStorageBinding(GLuint bindingPoint)
+{
+	static GLuint uncached;
+	if (bindingPoint < MAX_CACHED_STORAGE_BINDINGS) {
+		return &stateCache.storageBuffers[bindingPoint];
+	}
+	uncached = UNKNOWN_BINDING;
+	return &uncached;
+}
+
+void ForgetStorageBuffer(GLuint bufferName)
+{
+	for (unsigned int i = 0; i < MAX_CACHED_STORAGE_BINDINGS; ++i) {
+		if (stateCache.storageBuffers[i] == bufferName) {
+			stateCache.storageBuffers[i] = UNKNOWN_BINDING;
+		}
+	}
+}
+
+// Bit i of writtenBuffers is set if the shader may write to boundBuffers[i].
+void FinishDispatch(BufferObject **boundBuffers, unsigned int numBoundBuffers, unsigned int writtenBuffers, GLuint *boundTextures, unsigned int numBoundTextures)
+{
+	++dispatchSerial;
+
+	for (unsigned int i = 0; i < numBoundTextures; ++i) {
+		imageWriteSerials[boundTextures[i]] = dispatchSerial;
+	}
+	imageExternalBarrierPending = imageExternalBarrierPending || numBoundTextures > 0;
+
+	bool persistentBufferBound = false;
+	for (unsigned int i = 0; i < numBoundBuffers; ++i) {
+		if (writtenBuffers & (1u << i)) {
+			boundBuffers[i]->writeSerial = dispatchSerial;
+		}
+		persistentBufferBound = persistentBufferBound || boundBuffers[i]->mappedData;
+	}
+
+	if (persistentBufferBound) {
+		glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+		for (unsigned int i = 0; i < numBoundBuffers; ++i) {
+			if (boundBuffers[i]->mappedData) {
+				if (boundBuffers[i]->fence) {
+					glDeleteSync(boundBuffers[i]->fence);
+				}
+				boundBuffers[i]->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			}
+		}
+	}
+}
+
+bool IsValidRange(int offset, int size, int totalSize)
+{
+	return offset >= 0 && size > 0 && (long long)offset + size <= totalSize;
+}
+
+unsigned int CreatePersistentBuffer(GLsizei size, int flags)
+{
+	GLbitfield accessFlags = GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	if (flags & PERSISTENT_BUFFER_READ) {
+		accessFlags |= GL_MAP_READ_BIT;
+	}
+	if (flags & PERSISTENT_BUFFER_WRITE) {
+		accessFlags |= GL_MAP_WRITE_BIT;
+	}
+
+	GLuint bufferName;
+	glGenBuffers(1, &bufferName);
+	if (GetGLError() == GL_INVALID_VALUE) {
+		PluginError("Failed to create persistent buffer.");
+		return 0;
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferName);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, size, NULL, accessFlags);
+	switch (GetGLError()) {
+		case GL_INVALID_VALUE: {
+			PluginError("Failed to create persistent buffer. Invalid size or flags.");
+			glDeleteBuffers(1, &bufferName);
+			return 0;
+		}
+		case GL_INVALID_OPERATION: {
+			PluginError("Failed to create persistent buffer. Unknown or immutable buffer object used.");
+			glDeleteBuffers(1, &bufferName);
+			return 0;
+		}
+		case GL_OUT_OF_MEMORY: {
+			PluginError("Failed to create persistent buffer. Insufficient memory available.");
+			glDeleteBuffers(1, &bufferName);
+			return 0;
+		}
+	}
+
+	long long mapStart = TraceBegin();
+	void *mappedData = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size, accessFlags);
+	TraceEnd("Map", mapStart);
+	if (!mappedData) {
+		PluginError("Failed to create persistent buffer. Unable to map buffer storage.");
+		glDeleteBuffers(1, &bufferName);
+		return 0;
+	}
+
+	if (flags & PERSISTENT_BUFFER_WRITE) {
+		memset(mappedData, 0, size);
+	}
+
+	BufferObject *bufferObject = new BufferObject(bufferName, size);
+	bufferObject->persistentFlags = flags;
+	bufferObject->mappedData = mappedData;
+
+	unsigned int id = bufferObjects.insert(bufferObject);
+	if (!id) {
+		delete bufferObject;
+	}
+	return id;
+}
+
+bool AcquireStagingBuffer(GLsizei size, StagingBuffer *stagingBuffer)
+{
+	StagingBufferPool::iterator best = stagingBuffers.end();
+	for (StagingBufferPool::iterator iter = stagingBuffers.begin(); iter != stagingBuffers.end(); ++iter) {
+		if (iter->bufferSize >= size && (best == stagingBuffers.end() || iter->bufferSize < best->bufferSize)) {
+			best = iter;
+		}
+	}
+
+	if (best != stagingBuffers.end()) {
+		*stagingBuffer = *best;
+		*best = stagingBuffers.back();
+		stagingBuffers.pop_back();
+		return true;
+	}
+
+	glGenBuffers(1, &stagingBuffer->bufferName);
+	if (GetGLError() == GL_INVALID_VALUE) {
+		PluginError("Failed to create readback staging buffer.");
+		return false;
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, stagingBuffer->bufferName);
+	glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_READ);
+	switch (GetGLError()) {
+		case GL_INVALID_VALUE: {
+			PluginError("Failed to create readback staging buffer. Invalid size.");
+			glDeleteBuffers(1, &stagingBuffer->bufferName);
+			return false;
+		}
+		case GL_OUT_OF_MEMORY: {
+			PluginError("Failed to create readback staging buffer. Insufficient memory available.");
+			glDeleteBuffers(1, &stagingBuffer->bufferName);
+			return false;
+		}
+	}
+
+	stagingBuffer->bufferSize = size;
+	return true;
+}
+
+// Shaders opt in to knowing the number of invocations asked for by declaring a uniform ivec3 with the built-in name.
+void ComputeShader::setInvocationCount(int countX, int countY, int countZ)
+{
+	if (!invocationCount) {
+		return;
+	}
+
+	if (recordingList) {
+		recordingList->recordSetUniform(this, invocationCount, 0, countX, countY, countZ, 0);
+	}
+	else {
+		invocationCount->store(0, countX, countY, countZ, 0);
+	}
+}
+
+void RecordDispatch(unsigned int shaderID, ComputeShader *computeShader, int numGroupsX, int numGroupsY, int numGroupsZ, BufferObject *indirectBuffer, GLintptr indirectOffset)
+{
+	Command command;
+	command.type = COMMAND_DISPATCH;
+	command.dispatch.computeShader = computeShader;
+	command.dispatch.numGroups[0] = numGroupsX;
+	command.dispatch.numGroups[1] = numGroupsY;
+	command.dispatch.numGroups[2] = numGroupsZ;
+	command.dispatch.indirectBuffer = indirectBuffer;
+	command.dispatch.indirectOffset = indirectOffset;
+	command.dispatch.firstImageBinding = (unsigned int)recordingList->imageBindings.size();
+	command.dispatch.numImageBindings = 0;
+	command.dispatch.firstBufferBinding = (unsigned int)recordingList->bufferBindings.size();
+	command.dispatch.numBufferBindings = 0;
+
+	for (GLuint attachPoint = 0; attachPoint < MAX_IMAGE_BINDINGS; ++attachPoint) {
+		unsigned int imageID = computeShader->imageBindings[attachPoint];
+		if (imageID != 0) {
+			if (!agk::GetImageExists(imageID)) {
+				PluginError("Failed to record run of shader %u. Image %u does not exist. Has this image been deleted?", shaderID, imageID);
+				recordingList->imageBindings.resize(command.dispatch.firstImageBinding);
+				return;
+			}
+			ImageBindingRef binding = { attachPoint, imageID };
+			recordingList->imageBindings.push_back(binding);
+			++command.dispatch.numImageBindings;
+		}
+	}
+
+	for (unsigned int i = 0; i < MAX_BUFFER_BINDINGS && computeShader->bufferBindings[i].bufferID != 0; ++i) {
+		BufferObjectMap::iterator iter = bufferObjects.find(computeShader->bufferBindings[i].bufferID);
+		if (iter == bufferObjects.end()) {
+			PluginError("Failed to record run of shader %u. Buffer %u does not exist. Has this buffer been deleted?", shaderID, computeShader->bufferBindings[i].bufferID);
+			recordingList->imageBindings.resize(command.dispatch.firstImageBinding);
+			recordingList->bufferBindings.resize(command.dispatch.firstBufferBinding);
+			return;
+		}
+		BufferBindingRef binding = { computeShader->bufferBindings[i].bindingPoint, iter->second };
+		recordingList->bufferBindings.push_back(binding);
+		++command.dispatch.numBufferBindings;
+	}
+
+	recordingList->commands.push_back(command);
+}
+
+void RecordTransfer(CommandType type, unsigned int bufferID, BufferObject *bufferObject, unsigned int memblockID, int bufferOffset, int memblockOffset, int size)
+{
+	int requiredFlag = type == COMMAND_UPDATE_BUFFER ? PERSISTENT_BUFFER_WRITE : PERSISTENT_BUFFER_READ;
+	if (bufferObject->mappedData && !(bufferObject->persistentFlags & requiredFlag)) {
+		PluginError("Failed to record transfer for persistent buffer %u, as it was not created with the %s flag.", bufferID, requiredFlag == PERSISTENT_BUFFER_WRITE ? "write" : "read");
+		return;
+	}
+
+	Command command;
+	command.type = type;
+	command.transfer.bufferObject = bufferObject;
+	command.transfer.memblockID = memblockID;
+	command.transfer.bufferOffset = bufferOffset;
+	command.transfer.memblockOffset = memblockOffset;
+	command.transfer.size = size;
+	recordingList->commands.push_back(command);
+}
+
+void InvalidateCommandLists(ComputeShader *computeShader, BufferObject *bufferObject)
+{
+	for (CommandListMap::iterator iter = commandLists.begin(); iter != commandLists.end(); ++iter) {
+		CommandList *commandList = iter->second;
+		if (commandList->valid && ((computeShader && commandList->references(computeShader)) || (bufferObject && commandList->references(bufferObject)))) {
+			commandList->valid = false;
+		}
+	}
+}
+
+// Replayed commands were validated when recorded, so none of the GL calls here are checked for errors.
+bool ReplayDispatch(CommandList *commandList, DispatchCommand &dispatch)
+{
+	ComputeShader *computeShader = dispatch.computeShader;
+	BufferObject *boundBuffers[MAX_BUFFER_BINDINGS];
+	unsigned int writtenBuffers = 0;
+	GLuint boundTextures[MAX_IMAGE_BINDINGS];
+	GLbitfield barriers = 0;
+
+	if (stateCache.programName != computeShader->programName) {
+		glUseProgram(computeShader->programName);
+		stateCache.programName = computeShader->programName;
+	}
+
+	for (unsigned int i = 0; i < dispatch.numImageBindings; ++i) {
+		ImageBindingRef &binding = commandList->imageBindings[dispatch.firstImageBinding + i];
+		AGK::cImage *image = agk::GetImagePtr(binding.imageID);
+		if (!image) {
+			PluginError("Failed to execute command list. Image %u has been deleted.", binding.imageID);
+			return false;
+		}
+		if (stateCache.imageTextures[binding.attachPoint] != image->m_iTextureID) {
+			glBindImageTexture(binding.attachPoint, image->m_iTextureID, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
+			stateCache.imageTextures[binding.attachPoint] = image->m_iTextureID;
+		}
+		ImageWriteSerialMap::iterator serialIter = imageWriteSerials.find(image->m_iTextureID);
+		if (serialIter != imageWriteSerials.end()) {
+			barriers |= RequiredBarrier(serialIter->second, BARRIER_SHADER_IMAGE_ACCESS);
+		}
+		boundTextures[i] = image->m_iTextureID;
+	}
+
+	for (unsigned int i = 0; i < dispatch.numBufferBindings; ++i) {
+		BufferBindingRef &binding = commandList->bufferBindings[dispatch.firstBufferBinding + i];
+		GLuint *cachedBinding = CachedStorageBinding(binding.bindingPoint);
+		if (*cachedBinding != binding.bufferObject->bufferName) {
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding.bindingPoint, binding.bufferObject->bufferName);
+			*cachedBinding = binding.bufferObject->bufferName;
+		}
+		barriers |= RequiredBarrier(binding.bufferObject->writeSerial, BARRIER_SHADER_STORAGE);
+		boundBuffers[i] = binding.bufferObject;
+		if (!computeShader->isReadOnlyBinding(binding.bindingPoint)) {
+			writtenBuffers |= 1u << i;
+		}
+	}
+
+	computeShader->applyUniforms();
+
+	long long dispatchStart = TraceBegin();
+	if (dispatch.indirectBuffer) {
+		barriers |= RequiredBarrier(dispatch.indirectBuffer->writeSerial, BARRIER_COMMAND);
+		IssueBarriers(barriers);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, dispatch.indirectBuffer->bufferName);
+		glDispatchComputeIndirect(dispatch.indirectOffset);
+	}
+	else {
+		IssueBarriers(barriers);
+		glDispatchCompute(dispatch.numGroups[0], dispatch.numGroups[1], dispatch.numGroups[2]);
+	}
+	TraceEnd("Dispatch", dispatchStart);
+	FinishDispatch(boundBuffers, dispatch.numBufferBindings, writtenBuffers, boundTextures, dispatch.numImageBindings);
+	return true;
+}
+
+bool ReplayTransfer(CommandType type, TransferCommand &transfer)
+{
+	BufferObject *bufferObject = transfer.bufferObject;
+	unsigned char *memblockPtr = agk::GetMemblockPtr(transfer.memblockID);
+	if (!memblockPtr || agk::GetMemblockSize(transfer.memblockID) < transfer.memblockOffset + transfer.size) {
+		PluginError("Failed to execute command list. Memblock %u has been deleted or resized.", transfer.memblockID);
+		return false;
+	}
+	memblockPtr += transfer.memblockOffset;
+
+	if (bufferObject->mappedData) {
+		if (!bufferObject->waitForGPU()) {
+			PluginError("Failed to execute command list. Waiting for the GPU failed.");
+			return false;
+		}
+		unsigned char *bufferPtr = (unsigned char *)bufferObject->mappedData + transfer.bufferOffset;
+		if (type == COMMAND_UPDATE_BUFFER) {
+			long long copyStart = TraceBegin();
+			memcpy(bufferPtr, memblockPtr, transfer.size);
+			TraceEnd("Memcpy", copyStart);
+			TraceTransfer(true, transfer.size);
+		}
+		else {
+			long long copyStart = TraceBegin();
+			memcpy(memblockPtr, bufferPtr, transfer.size);
+			TraceEnd("Memcpy", copyStart);
+			TraceTransfer(false, transfer.size);
+		}
+		return true;
+	}
+
+	SyncBufferForTransfer(bufferObject);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferObject->bufferName);
+	if (type == COMMAND_UPDATE_BUFFER) {
+		long long uploadStart = TraceBegin();
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, transfer.bufferOffset, transfer.size, memblockPtr);
+		TraceEnd("Upload", uploadStart);
+		TraceTransfer(true, transfer.size);
+		return true;
+	}
+
+	long long mapStart = TraceBegin();
+	void *data = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, transfer.bufferOffset, transfer.size, GL_MAP_READ_BIT);
+	TraceEnd("Map", mapStart);
+	if (!data) {
+		PluginError("Failed to execute command list. Unable to map buffer for reading.");
+		return false;
+	}
+	long long copyStart = TraceBegin();
+	memcpy(memblockPtr, data, transfer.size);
+	TraceEnd("Memcpy", copyStart);
+	TraceTransfer(false, transfer.size);
+	long long unmapStart = TraceBegin();
+	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+	TraceEnd("Unmap", unmapStart);
+	return true;
+}
+
+template <typename I> struct SetShaderConstantError { static char const *format; };
+template <> char const *SetShaderConstantError<unsigned int>::format = "Failed to find shader constant at location %u in shader %u.";
+template <> char const *SetShaderConstantError<char *>::format = "Failed to find shader constant '%s' in shader %u.";
+template <> char const *SetShaderConstantError<UniformHandle>::format = "Invalid shader constant handle %u for shader %u.";
+
+unsigned int ErrorArgument(unsigned int identifier) { return identifier; }
+char *ErrorArgument(char *identifier) { return identifier; }
+unsigned int ErrorArgument(UniformHandle identifier) { return identifier.value; }
+
+template <typename T, typename I>
+void SetShaderConstant(unsigned int shaderID, I identifier, int index, T v1, T v2, T v3, T v4)
+{
+	FinishPendingShader(shaderID);
+	ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
+	if (iter == computeShaders.end()) {
+		PluginError("Attempting to set constant on unknown shader %u.", shaderID);
+		return;
+	}
+
+	ComputeShader *computeShader = iter->second;
+
+	Uniform *uniform = computeShader->findUniform(identifier);
+	if (!uniform) {
+		PluginError(SetShaderConstantError<I>::format, ErrorArgument(identifier), shaderID);
+		return;
+	}
+
+	if (recordingList) {
+		if (uniform->canSet(index)) {
+			recordingList->recordSetUniform(computeShader, uniform, index, v1, v2, v3, v4);
+		}
+		return;
+	}
+	uniform->set(index, v1, v2, v3, v4);
+}
+
+void CollectTimerQueries()
+{
+	while (profiler.numPendingQueries > 0) {
+		TimerQuery *query = &profiler.queries[profiler.oldestQuery];
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(query->queryNames[1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			break;
+		}
+
+		GLuint64 timestamps[2] = { 0, 0 };
+		glGetQueryObjectui64v(query->queryNames[0], GL_QUERY_RESULT, &timestamps[0]);
+		glGetQueryObjectui64v(query->queryNames[1], GL_QUERY_RESULT, &timestamps[1]);
+		long long elapsed = (long long)(timestamps[1] - timestamps[0]);
+		float milliseconds = (float)(elapsed / 1000000.0);
+
+		if (tracer.enabled && (long long)timestamps[0] + tracer.gpuOffset >= 0) {
+			char const *name = query->commandList ? "ExecuteCommandList" : "Dispatch";
+			AddTraceEvent(name, TRACE_EVENT_GPU_SPAN, (long long)timestamps[0] + tracer.gpuOffset, elapsed);
+		}
+
+		if (profiler.frameOpen && query->frame != profiler.frame) {
+			profiler.lastFrameTime = profiler.frameTime;
+			profiler.frameOpen = false;
+		}
+		if (!profiler.frameOpen) {
+			profiler.frameOpen = true;
+			profiler.frame = query->frame;
+			profiler.frameTime = 0.0f;
+		}
+		profiler.frameTime += milliseconds;
+
+		if (query->computeShader) {
+			query->computeShader->gpuTime = milliseconds;
+		}
+		if (query->commandList) {
+			query->commandList->gpuTime = milliseconds;
+		}
+
+		profiler.oldestQuery = (profiler.oldestQuery + 1) % NUM_TIMER_QUERIES;
+		profiler.numPendingQueries -= 1;
+	}
+
+	// The frame being totalled is complete once none of its queries are left, and the app has moved on from it.
+	if (profiler.frameOpen) {
+		float nextFrame = profiler.numPendingQueries > 0 ? profiler.queries[profiler.oldestQuery].frame : agk::GetRunTime();
+		if (nextFrame != profiler.frame) {
+			profiler.lastFrameTime = profiler.frameTime;
+			profiler.frameOpen = false;
+		}
+	}
+}
+
+// Queries are needed while profiling or tracing, and are deleted once neither wants them. Any results still pending are
+// discarded.
+void UpdateTimerQueries()
+{
+	bool wanted = profiler.enabled || tracer.enabled;
+	if (wanted == profiler.queriesCreated) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < NUM_TIMER_QUERIES; ++i) {
+		if (wanted) {
+			glGenQueries(2, profiler.queries[i].queryNames);
+		}
+		else {
+			glDeleteQueries(2, profiler.queries[i].queryNames);
+		}
+	}
+	profiler.queriesCreated = wanted;
+	profiler.oldestQuery = 0;
+	profiler.numPendingQueries = 0;
+	profiler.frameOpen = false;
+}
+
+// Returns NULL when profiling and tracing are off, or when every query is still waiting for the GPU, in which case the
+// work is not timed rather than stalling until a query becomes free.
+TimerQuery *BeginTimerQuery()
+{
+	if (!profiler.queriesCreated) {
+		return NULL;
+	}
+
+	CollectTimerQueries();
+	if (profiler.numPendingQueries == NUM_TIMER_QUERIES) {
+		return NULL;
+	}
+
+	TimerQuery *query = &profiler.queries[(profiler.oldestQuery + profiler.numPendingQueries) % NUM_TIMER_QUERIES];
+	profiler.numPendingQueries += 1;
+	query->computeShader = NULL;
+	query->commandList = NULL;
+	query->frame = agk::GetRunTime();
+	glQueryCounter(query->queryNames[0], GL_TIMESTAMP);
+	return query;
+}
+
+void EndTimerQuery(TimerQuery *query)
+{
+	if (query) {
+		glQueryCounter(query->queryNames[1], GL_TIMESTAMP);
+	}
+}
+
+void ForgetTimerQueries(ComputeShader *computeShader, CommandList *commandList)
+{
+	for (unsigned int i = 0; i < profiler.numPendingQueries; ++i) {
+		TimerQuery *query = &profiler.queries[(profiler.oldestQuery + i) % NUM_TIMER_QUERIES];
+		if (computeShader && query->computeShader == computeShader) {
+			query->computeShader = NULL;
+		}
+		if (commandList && query->commandList == commandList) {
+			query->commandList = NULL;
+		}
+	}
+}
+
+// Re-reads every cached include file, updating those that have changed and adding their paths to changedIncludes.
+// Files that cannot currently be read, as happens briefly while some editors save, are left as they were.
+void RefreshIncludeFiles(std::vector<std::string> &changedIncludes)
+{
+	for (IncludeFileMap::iterator iter = includeFileCache.begin(); iter != includeFileCache.end(); ++iter) {
+		if (!agk::GetFileExists(iter->first.c_str())) {
+			continue;
+		}
+		char *source = ReadShaderFile(iter->first.c_str());
+		if (!source) {
+			continue;
+		}
+
+		IncludeFile *includeFile = iter->second;
+		unsigned long long hash = HashString(source);
+		if (hash != includeFile->hash) {
+			std::vector<IncludeDirective> directives;
+			if (FindIncludes(source, iter->first.c_str(), directives)) {
+				includeFile->source = source;
+				includeFile->directives = directives;
+				includeFile->hash = hash;
+				changedIncludes.push_back(iter->first);
+			}
+		}
+		free(source);
+	}
+}
+
+// Starts compiling the shader again if its source has changed. The new program is not used until FinishShaderReload
+// finds that it compiled, so if it has errors, the shader keeps running the old one.
+bool IncludesChanged(ShaderOrigin const &origin, std::vector<std::string> const &changedIncludes)
+{
+	for (size_t i = 0; i < origin.includes.size(); ++i) {
+		if (std::find(changedIncludes.begin(), changedIncludes.end(), origin.includes[i]) != changedIncludes.end()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void StartShaderReload(unsigned int shaderID, ComputeShader *computeShader, std::vector<std::string> const &changedIncludes)
+{
+	ShaderOrigin &origin = computeShader->origin;
+	if (!agk::GetFileExists(origin.sourceFile.c_str())) {
+		return;
+	}
+	char *shaderSource = ReadShaderFile(origin.sourceFile.c_str());
+	if (!shaderSource) {
+		return;
+	}
+
+	if (HashString(shaderSource) == origin.fileHash && !IncludesChanged(origin, changedIncludes)) {
+		free(shaderSource);
+		return;
+	}
+
+	// The origin is updated even if the new source fails, so that the failure is reported once rather than at every
+	// check, and the shader is next reloaded when one of its files changes again.
+	origin.fileHash = HashString(shaderSource);
+	std::string compileSource;
+	std::vector<std::string> includes;
+	unsigned long long cacheKey;
+	bool prepared = PrepareShaderSource(shaderSource, origin.sourceFile.c_str(), origin.defineList.c_str(), compileSource, includes, &cacheKey);
+	free(shaderSource);
+	if (!prepared || cacheKey == origin.sourceKey) {
+		return;
+	}
+	origin.sourceKey = cacheKey;
+	origin.includes = includes;
+	FindReadOnlyBlocks(compileSource.c_str(), origin.readOnlyBlocks);
+
+	PendingShader *reload = new PendingShader();
+	reload->cacheKey = cacheKey;
+	reload->saveToCache = shaderCacheFolder != NULL;
+	reload->failed = false;
+	reload->origin = origin;
+	reload->shaderName = 0;
+	reload->programName = shaderCacheFolder ? LoadCachedProgram(cacheKey) : 0;
+	if (!reload->programName) {
+		reload->programName = StartCompileProgram(&compileSource[0], shaderCacheFolder != NULL, &reload->shaderName);
+		if (!reload->programName) {
+			delete reload;
+			return;
+		}
+	}
+	shaderWatch.reloads[shaderID] = reload;
+}
+
+// Swaps a reloaded program into the shader. Constants are copied across by name, and buffers, images and shared
+// constant blocks stay attached, so the app carries on as it was. Command lists that use the shader hold on to parts of
+// the old one, so they have to be recorded again.
+void ReplaceShaderProgram(ComputerShaderMap::iterator iter, GLuint programName, ShaderOrigin const &origin)
+{
+	ComputeShader *oldShader = iter->second;
+	ComputeShader *newShader = new ComputeShader(programName);
+	newShader->origin = origin;
+	newShader->findReadOnlyBindings();
+	newShader->gpuTime = oldShader->gpuTime;
+	memcpy(newShader->imageBindings, oldShader->imageBindings, sizeof(newShader->imageBindings));
+	memcpy(newShader->bufferBindings, oldShader->bufferBindings, sizeof(newShader->bufferBindings));
+
+	for (size_t i = 0; i < newShader->blocks.size(); ++i) {
+		UniformBlock *oldBlock = oldShader->findBlock(newShader->blocks[i].name);
+		if (oldBlock && oldBlock->buffer->refCount > 1 && oldBlock->buffer->size == newShader->blocks[i].buffer->size) {
+			newShader->shareBlock(&newShader->blocks[i], oldBlock->buffer);
+		}
+	}
+
+	for (GLuint i = 0; i < newShader->numUniforms; ++i) {
+		Uniform *uniform = newShader->getUniform(i);
+		Uniform *oldUniform = oldShader->findUniformByName(uniform->getName());
+		if (!uniform->data || !oldUniform || !oldUniform->data || oldUniform->type != uniform->type ||
+			(uniform->buffer && uniform->buffer == oldUniform->buffer)) {
+			continue;
+		}
+		int count = std::min(uniform->size, oldUniform->size);
+		for (int j = 0; j < count; ++j) {
+			memcpy((unsigned char *)uniform->data + j * uniform->stride, (unsigned char *)oldUniform->data + j * oldUniform->stride, sizeof(float) * uniform->vecSize);
+		}
+		uniform->markDirty(0, count);
+	}
+
+	// Handles the app already has keep referring to the same names. Uniforms new to this version are given new handles.
+	std::vector<bool> handled(newShader->numUniforms, false);
+	newShader->handleUniforms.clear();
+	for (size_t i = 0; i < oldShader->handleUniforms.size(); ++i) {
+		int index = -1;
+		if (oldShader->handleUniforms[i] >= 0) {
+			Uniform *uniform = newShader->findUniformByName(oldShader->getUniform(oldShader->handleUniforms[i])->getName());
+			if (uniform) {
+				index = (int)(((unsigned char *)uniform - newShader->uniforms) / newShader->uniformSize);
+				handled[index] = true;
+			}
+		}
+		newShader->handleUniforms.push_back(index);
+	}
+	for (GLuint i = 0; i < newShader->numUniforms; ++i) {
+		if (!handled[i]) {
+			newShader->handleUniforms.push_back((int)i);
+		}
+	}
+
+	InvalidateCommandLists(oldShader, NULL);
+	ForgetTimerQueries(oldShader, NULL);
+	// Variants' programs are shared with other shaders, so are left alone.
+	if (!oldShader->variant) {
+		if (stateCache.programName == oldShader->programName) {
+			stateCache.programName = UNKNOWN_BINDING;
+		}
+		glDeleteProgram(oldShader->programName);
+	}
+	delete oldShader;
+	iter->second = newShader;
+}
+
+void FinishShaderReload(PendingShaderMap::iterator reloadIter)
+{
+	unsigned int shaderID = reloadIter->first;
+	PendingShader *reload = reloadIter->second;
+	GLuint programName = reload->programName;
+	if (reload->shaderName) {
+		programName = FinishCompileProgram(reload->shaderName, reload->programName);
+		if (programName && reload->saveToCache && shaderCacheFolder) {
+			SaveCachedProgram(reload->cacheKey, programName);
+		}
+	}
+
+	ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
+	if (programName && iter != computeShaders.end()) {
+		ReplaceShaderProgram(iter, programName, reload->origin);
+	}
+	else {
+		PluginError("Failed to reload shader %u from '%s'. The shader will carry on using its previous version.", shaderID, reload->origin.sourceFile.c_str());
+	}
+	delete reload;
+	shaderWatch.reloads.erase(reloadIter);
+}
+
+void CancelShaderReload(unsigned int shaderID)
+{
+	PendingShaderMap::iterator iter = shaderWatch.reloads.find(shaderID);
+	if (iter != shaderWatch.reloads.end()) {
+		PendingShader *reload = iter->second;
+		if (reload->shaderName) {
+			glDeleteShader(reload->shaderName);
+		}
+		glDeleteProgram(reload->programName);
+		delete reload;
+		shaderWatch.reloads.erase(iter);
+	}
+}
+
+// Called by the commands that run shaders, as the plugin has no other way to find out that a frame has passed. Checks
+// the files on the first call of every interval frames, and swaps in any reloads that the driver has finished. Nothing
+// is swapped while a command list is being recorded, as the list refers to the shaders as they are.
+void UpdateShaderWatch()
+{
+	if (!shaderWatch.interval || recordingList) {
+		return;
+	}
+
+	float frame = agk::GetRunTime();
+	if (frame != shaderWatch.frame) {
+		shaderWatch.frame = frame;
+		shaderWatch.framesUntilCheck -= 1;
+		if (shaderWatch.framesUntilCheck <= 0) {
+			shaderWatch.framesUntilCheck = shaderWatch.interval;
+			std::vector<std::string> changedIncludes;
+			RefreshIncludeFiles(changedIncludes);
+			for (ComputerShaderMap::iterator iter = computeShaders.begin(); iter != computeShaders.end(); ++iter) {
+				if (iter->second->origin.sourceFile.empty()) {
+					continue;
+				}
+				// The changed includes are only reported once, so a reload already under way that misses them has to be
+				// followed by another. Changes to the shader's own file are found by the next check.
+				if (shaderWatch.reloads.find(iter->first) == shaderWatch.reloads.end()) {
+					StartShaderReload(iter->first, iter->second, changedIncludes);
+				}
+				else if (IncludesChanged(iter->second->origin, changedIncludes) &&
+					std::find(shaderWatch.staleReloads.begin(), shaderWatch.staleReloads.end(), iter->first) == shaderWatch.staleReloads.end()) {
+					shaderWatch.staleReloads.push_back(iter->first);
+				}
+			}
+		}
+	}
+
+	for (PendingShaderMap::iterator iter = shaderWatch.reloads.begin(); iter != shaderWatch.reloads.end();) {
+		PendingShaderMap::iterator next = std::next(iter);
+		if (!iter->second->shaderName || IsPendingShaderComplete(iter->second)) {
+			FinishShaderReload(iter);
+		}
+		iter = next;
+	}
+
+	// Passing every include as changed makes StartShaderReload rebuild the source from the files as they are now.
+	for (size_t i = 0; i < shaderWatch.staleReloads.size();) {
+		unsigned int shaderID = shaderWatch.staleReloads[i];
+		if (shaderWatch.reloads.find(shaderID) != shaderWatch.reloads.end()) {
+			++i;
+			continue;
+		}
+		ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
+		if (iter != computeShaders.end()) {
+			StartShaderReload(shaderID, iter->second, iter->second->origin.includes);
+		}
+		shaderWatch.staleReloads.erase(shaderWatch.staleReloads.begin() + i);
+	}
+}
+
+// Binds everything the shader needs and dispatches it, either with the group counts given or, when indirectBuffer is
+// set, with the counts the GPU finds at indirectOffset in that buffer.
+void DispatchShader(ComputeShader *computeShader, int numGroupsX, int numGroupsY, int numGroupsZ, BufferObject *indirectBuffer, GLintptr indirectOffset)
+{
+	BufferObject *boundBuffers[MAX_BUFFER_BINDINGS];
+	unsigned int numBoundBuffers = 0;
+	unsigned int writtenBuffers = 0;
+	GLuint boundTextures[MAX_IMAGE_BINDINGS];
+	unsigned int numBoundTextures = 0;
+	GLbitfield barriers = 0;
+	TimerQuery *timerQuery = NULL;
+	long long dispatchStart = -1;
+
+	BeginStateBatch();
+
+	if (stateCache.programName != computeShader->programName) {
+		glUseProgram(computeShader->programName);
+		switch (GetGLError()) {
+			case GL_INVALID_VALUE: {
+				PluginError("Failed to run shader. Unknown program.");
+				goto exit_run_shader;
+			}
+			case GL_INVALID_OPERATION: {
+				PluginError("Failed to run shader. Non-program object used, or unable to make program part of current state.");
+				goto exit_run_shader;
+			}
+		}
+		stateCache.programName = computeShader->programName;
+	}
+
+	for (GLuint attachPoint = 0; attachPoint < MAX_IMAGE_BINDINGS; ++attachPoint) {
+		if (computeShader->imageBindings[attachPoint] != 0) {
+			unsigned int imageID = computeShader->imageBindings[attachPoint];
+			AGK::cImage *image = agk::GetImagePtr(imageID);
+			if (!image) {
+				PluginError("Failed to attach image %u to computer shader. Has this image been deleted?", imageID);
+				goto exit_run_shader;
+			}
+
+			if (stateCache.imageTextures[attachPoint] != image->m_iTextureID) {
+				glBindImageTexture(attachPoint, image->m_iTextureID, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
+				switch (GetGLError()) {
+					case GL_INVALID_VALUE: {
+						PluginError("Failed to attach image %u to computer shader. Invalid attach point, texture name, level, or layer.", imageID);
+						goto exit_run_shader;
+					}
+					case GL_INVALID_ENUM: {
+						PluginError("Failed to attach image %u to computer shader. Invalid format or access settings.", imageID);
+						goto exit_run_shader;
+					}
+				}
+				stateCache.imageTextures[attachPoint] = image->m_iTextureID;
+			}
+
+			ImageWriteSerialMap::iterator serialIter = imageWriteSerials.find(image->m_iTextureID);
+			if (serialIter != imageWriteSerials.end()) {
+				barriers |= RequiredBarrier(serialIter->second, BARRIER_SHADER_IMAGE_ACCESS);
+			}
+			boundTextures[numBoundTextures++] = image->m_iTextureID;
+		}
+	}
+
+	for (unsigned int i = 0; i < MAX_BUFFER_BINDINGS; ++i) {
+		if (computeShader->bufferBindings[i].bufferID == 0) {
+			break;
+		}
+
+		BufferObjectMap::iterator iter = bufferObjects.find(computeShader->bufferBindings[i].bufferID);
+		if (iter == bufferObjects.end()) {
+			PluginError("Failed to bind non-existent buffer %u. Has this buffer been deleted?", computeShader->bufferBindings[i].bufferID);
+			goto exit_run_shader;
+		}
+
+		BufferObject *bufferObject = iter->second;
+		barriers |= RequiredBarrier(bufferObject->writeSerial, BARRIER_SHADER_STORAGE);
+		if (!computeShader->isReadOnlyBinding(computeShader->bufferBindings[i].bindingPoint)) {
+			writtenBuffers |= 1u << numBoundBuffers;
+		}
+		boundBuffers[numBoundBuffers++] = bufferObject;
+
+		GLuint *cachedBinding = CachedStorageBinding(computeShader->bufferBindings[i].bindingPoint);
+		if (*cachedBinding != bufferObject->bufferName) {
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, computeShader->bufferBindings[i].bindingPoint, bufferObject->bufferName);
+			switch (GetGLError()) {
+				case GL_INVALID_ENUM: {
+					PluginError("Failed to bind buffer. Invalid target.");
+					goto exit_run_shader;
+				}
+				case GL_INVALID_VALUE: {
+					PluginError("Failed to bind buffer. Invalid binding point or empty buffer used.");
+					goto exit_run_shader;
+				}
+			}
+			*cachedBinding = bufferObject->bufferName;
+		}
+	}
+
+	computeShader->applyUniforms();
+
+	if (indirectBuffer) {
+		barriers |= RequiredBarrier(indirectBuffer->writeSerial, BARRIER_COMMAND);
+	}
+
+	IssueBarriers(barriers);
+
+	timerQuery = BeginTimerQuery();
+	if (timerQuery) {
+		timerQuery->computeShader = computeShader;
+	}
+	dispatchStart = TraceBegin();
+	if (indirectBuffer) {
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, indirectBuffer->bufferName);
+		glDispatchComputeIndirect(indirectOffset);
+	}
+	else {
+		glDispatchCompute(numGroupsX, numGroupsY, numGroupsZ);
+	}
+	TraceEnd("Dispatch", dispatchStart);
+	EndTimerQuery(timerQuery);
+	switch (GetGLError()) {
+		case GL_INVALID_VALUE: {
+			PluginError("Failed to run shader. Too many global work groups requested.");
+			goto exit_run_shader;
+		}
+		case GL_INVALID_OPERATION: {
+			PluginError("Failed to run shader. No active compute shader found.");
+			goto exit_run_shader;
+		}
+	}
+
+	FinishDispatch(boundBuffers, numBoundBuffers, writtenBuffers, boundTextures, numBoundTextures);
+
+exit_run_shader:
+	EndStateBatch();
+}
+
+template <typename I>
+void SetShaderConstantArrayFromMemblock(unsigned int shaderID, I identifier, unsigned int memblockID, int offset, int count)
+{
+	FinishPendingShader(shaderID);
+	ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
+	if (iter == computeShaders.end()) {
+		PluginError("Attempting to set constant on unknown shader %u.", shaderID);
+		return;
+	}
+
+	ComputeShader *computeShader = iter->second;
+
+	Uniform *uniform = computeShader->findUniform(identifier);
+	if (!uniform) {
+		PluginError(SetShaderConstantError<I>::format, ErrorArgument(identifier), shaderID);
+		return;
+	}
+
+	if (!uniform->canSet(0)) {
+		return;
+	}
+
+	if (count <= 0 || count > uniform->size) {
+		PluginError("Failed to set shader constant '%s' from memblock. Count %d is invalid, as the uniform has %d elements.", uniform->getName(), count, uniform->size);
+		return;
+	}
+
+	if (!agk::GetMemblockExists(memblockID)) {
+		PluginError("Failed to set shader constant '%s' from memblock. Memblock %u does not exist.", uniform->getName(), memblockID);
+		return;
+	}
+
+	int size = (int)sizeof(float) * uniform->vecSize * count;
+	if (!IsValidRange(offset, size, agk::GetMemblockSize(memblockID))) {
+		PluginError("Failed to set shader constant '%s' from memblock. %d bytes at offset %d do not fit in memblock %u.", uniform->getName(), size, offset, memblockID);
+		return;
+	}
+
+	if (recordingList) {
+		Command command;
+		command.type = COMMAND_LOAD_UNIFORM;
+		command.loadUniform.computeShader = computeShader;
+		command.loadUniform.uniform = uniform;
+		command.loadUniform.memblockID = memblockID;
+		command.loadUniform.memblockOffset = offset;
+		command.loadUniform.count = count;
+		recordingList->commands.push_back(command);
+		return;
+	}
+
+	uniform->load(agk::GetMemblockPtr(memblockID) + offset, count);
+}
+
+extern "C"
+{
+	DLL_EXPORT int Compute_IsSupportedCompute()
+	{
+		TRACE_COMMAND();
+
+		CheckInit();
+
+		if (PLUGIN_STATE_UNSUPPORTED == pluginState) {
+			return 0;
+		}
+		return 1;
+	}
+
+	DLL_EXPORT int Compute_IsSupportedSPIRV()
+	{
+		TRACE_COMMAND();
+
+		if (!CheckInit() || !specializeShader) {
+			return 0;
+		}
+		return 1;
+	}
+
+	DLL_EXPORT int Compute_IsSupportedShaderCache()
+	{
+		TRACE_COMMAND();
+
+		if (!CheckInit()) {
+			return 0;
+		}
+
+		// A driver may support program binaries in name only, reporting no formats to save them in.
+		GLint numFormats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+		return numFormats > 0 ? 1 : 0;
+	}
+
+	DLL_EXPORT void Compute_SetErrorMode(int mode)
+	{
+		TRACE_COMMAND();
+
+		switch (mode) {
+			case ERROR_MODE_IGNORE:
+			case ERROR_MODE_REPORT_FIRST:
+			case ERROR_MODE_REPORT_ALL:
+			case ERROR_MODE_STOP:
+				errorMode = (ErrorMode)mode;
+				break;
+
+			default:
+				PluginError("Invalid error mode %d.", mode);
+				break;
+		}
+	}
+
+	DLL_EXPORT void Compute_SetValidationLevel(int level)
+	{
+		TRACE_COMMAND();
+
+		switch (level) {
+			case VALIDATION_LEVEL_OFF:
+			case VALIDATION_LEVEL_ERRORS:
+			case VALIDATION_LEVEL_DEBUG:
+				break;
+
+			default:
+				PluginError("Invalid validation level %d.", level);
+				return;
+		}
+
+		if (!CheckInit()) {
+			return;
+		}
+
+		if (VALIDATION_LEVEL_DEBUG == level && !glDebugMessageCallback) {
+			PluginError("Debug validation is not supported on this platform. Using error validation instead.");
+			level = VALIDATION_LEVEL_ERRORS;
+		}
+
+		// Errors raised while validation was off would otherwise be blamed on the next checked call.
+		if (VALIDATION_LEVEL_OFF == validationLevel && VALIDATION_LEVEL_OFF != level) {
+			while (glGetError() != GL_NO_ERROR);
+		}
+
+		if (VALIDATION_LEVEL_DEBUG == level) {
+			glEnable(GL_DEBUG_OUTPUT);
+			glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+			glDebugMessageCallback(DebugMessageCallback, NULL);
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+		}
+		else if (VALIDATION_LEVEL_DEBUG == validationLevel) {
+			glDebugMessageCallback(NULL, NULL);
+			glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+			glDisable(GL_DEBUG_OUTPUT);
+		}
+
+		validationLevel = (ValidationLevel)level;
+	}
+
+	DLL_EXPORT void Compute_SetShaderCacheFolder(char *folder)
+	{
+		TRACE_COMMAND();
+
+		if (shaderCacheFolder) {
+			free(shaderCacheFolder);
+			shaderCacheFolder = NULL;
+		}
+
+		size_t len = folder ? strlen(folder) : 0;
+		while (len > 0 && (folder[len - 1] == '/' || folder[len - 1] == '\\')) {
+			len -= 1;
+		}
+		if (!len) {
+			return;
+		}
+
+		shaderCacheFolder = (char *)malloc(len + 1);
+		memcpy(shaderCacheFolder, folder, len);
+		shaderCacheFolder[len] = '\0';
+		agk::MakeFolder(shaderCacheFolder);
+	}
+
+	DLL_EXPORT void Compute_SetShaderWatchInterval(int frames)
+	{
+		TRACE_COMMAND();
+
+		if (frames < 0) {
+			PluginError("Failed to set shader watch interval to %d frames. The interval must be 0 or more.", frames);
+			return;
+		}
+
+		// Reloads already under way are finished off rather than lost.
+		if (!frames) {
+			while (!shaderWatch.reloads.empty()) {
+				FinishShaderReload(shaderWatch.reloads.begin());
+			}
 		}
+		shaderWatch.interval = frames;
+		shaderWatch.framesUntilCheck = frames;
+		shaderWatch.frame = agk::GetRunTime();
+	}
 
-		case PLUGIN_STATE_READY:
-			return true;
+	DLL_EXPORT int Compute_GetShaderCacheHits()
+	{
+		TRACE_COMMAND();
 
-		case PLUGIN_STATE_UNSUPPORTED:
-			return false;
+		return (int)shaderCacheHits;
 	}
 
-	return false;
-}
+	DLL_EXPORT int Compute_GetShaderCacheMisses()
+	{
+		TRACE_COMMAND();
 
-template <typename V>
-unsigned int NextID(unsigned int &nextID, std::unordered_map<unsigned int, V> lookupTable)
-{
-	while (lookupTable.find(nextID) != lookupTable.end() || nextID == 0) {
-		nextID += 1;
+		return (int)shaderCacheMisses;
 	}
-	return nextID;
-}
 
-unsigned int NextShaderID()
-{
-	return NextID(nextShaderID, computeShaders);
-}
+	DLL_EXPORT void Compute_SetProfilingEnabled(int enabled)
+	{
+		TRACE_COMMAND();
 
-unsigned int NextBufferID()
-{
-	return NextID(nextBufferID, bufferObjects);
-}
+		if (!CheckInit()) {
+			return;
+		}
 
-char *GenerateFullShaderSource(char *sourceCode)
-{
-	size_t len = strlen(sourceCode);
-	bool prependVersion = false;
-	char *c = sourceCode;
-	while (*c && (*c == '\n' || *c == ' ' || *c == '\t' || *c == '\r')) c++;
-	if (!c || memcmp(c, "#version", 8) != 0) {
-		len += strlen(shaderVersion);
-		prependVersion = true;
-	}
-	char *sourceBuffer = (char *)malloc(len + 1);
-	if (prependVersion) {
-		strcpy(sourceBuffer, shaderVersion);
-		strcat(sourceBuffer, sourceCode);
-	}
-	else {
-		strcpy(sourceBuffer, sourceCode);
+		profiler.enabled = enabled != 0;
+		UpdateTimerQueries();
 	}
-	return sourceBuffer;
-}
 
-unsigned int CreateBuffer(GLsizei size, void *data)
-{
-	GLuint bufferName;
-	glGenBuffers(1, &bufferName);
-	if (glGetError() == GL_INVALID_VALUE) {
-		PluginError("Failed to create buffer.");
-		return 0;
-	}
+	DLL_EXPORT float Compute_GetShaderGpuTime(unsigned int shaderID)
+	{
+		TRACE_COMMAND();
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferName);
-	switch (glGetError()) {
-		case GL_INVALID_ENUM: {
-			PluginError("Failed to create buffer. Invalid target.");
-			return 0;
+		ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
+		if (iter == computeShaders.end()) {
+			PluginError("Attempting to get GPU time of unknown shader %u.", shaderID);
+			return 0.0f;
 		}
-		case GL_INVALID_VALUE: {
-			PluginError("Failed to create buffer. Unknown buffer name.");
-			return 0;
+
+		if (profiler.queriesCreated) {
+			CollectTimerQueries();
 		}
+		return iter->second->gpuTime;
 	}
 
-	glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STATIC_COPY);
-	switch (glGetError()) {
-		case GL_INVALID_ENUM: {
-			PluginError("Failed to create buffer. Invalid target or usage.");
-			return 0;
-		}
-		case GL_INVALID_VALUE: {
-			PluginError("Failed to create buffer. Invalid memblock size.");
-			return 0;
-		}
-		case GL_INVALID_OPERATION: {
-			PluginError("Failed to create buffer. Unknown or immutable buffer object used.");
-			return 0;
+	DLL_EXPORT float Compute_GetCommandListGpuTime(unsigned int commandListID)
+	{
+		TRACE_COMMAND();
+
+		CommandListMap::iterator iter = commandLists.find(commandListID);
+		if (iter == commandLists.end()) {
+			PluginError("Attempting to get GPU time of unknown command list %u.", commandListID);
+			return 0.0f;
 		}
-		case GL_OUT_OF_MEMORY: {
-			PluginError("Failed to create buffer. Insufficient memory available.");
-			return 0;
+
+		if (profiler.queriesCreated) {
+			CollectTimerQueries();
 		}
+		return iter->second->gpuTime;
 	}
 
-	unsigned int id = NextBufferID();
-	bufferObjects[id] = new BufferObject(bufferName, size);
-	return id;
-}
-
-template <typename I> struct SetShaderConstantError { static char const *format; };
-template <> char const *SetShaderConstantError<unsigned int>::format = "Failed to find shader constant at location %u in shader %u.";
-template <> char const *SetShaderConstantError<char *>::format = "Failed to find shader constant '%s' in shader %u.";
+	DLL_EXPORT float Compute_GetLastFrameComputeTime()
+	{
+		TRACE_COMMAND();
 
-template <typename T, typename I>
-void SetShaderConstant(unsigned int shaderID, I identifier, int index, T v1, T v2, T v3, T v4)
-{
-	ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
-	if (iter == computeShaders.end()) {
-		PluginError("Attempting to set constant on unknown shader %u.", shaderID);
-		return;
+		if (profiler.queriesCreated) {
+			CollectTimerQueries();
+		}
+		return profiler.lastFrameTime;
 	}
 
-	ComputeShader *computeShader = iter->second;
+	DLL_EXPORT void Compute_StartTrace()
+	{
+		TRACE_COMMAND();
 
-	for (GLuint i = 0; i < computeShader->numUniforms; ++i) {
-		Uniform *uniform = computeShader->getUniform(i);
-		if (uniform->matchesIdentifier(identifier)) {
-			uniform->set(index, v1, v2, v3, v4);
+		if (!CheckInit()) {
 			return;
 		}
-	}
 
-	PluginError(SetShaderConstantError<I>::format, identifier, shaderID);
-}
+		tracer.events.clear();
+		tracer.origin = std::chrono::steady_clock::now();
+		tracer.frame = agk::GetRunTime();
+		tracer.bytesUploaded = 0;
+		tracer.bytesDownloaded = 0;
 
-extern "C"
-{
-	DLL_EXPORT int Compute_IsSupportedCompute()
-	{
-		CheckInit();
+		// GPU timestamps are on the GPU's own clock. Reading the current GPU time here gives the offset to the trace's.
+		GLint64 gpuNow = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+		tracer.gpuOffset = TraceNow() - (long long)gpuNow;
 
-		if (PLUGIN_STATE_UNSUPPORTED == pluginState) {
-			return 0;
-		}
-		return 1;
+		tracer.enabled = true;
+		UpdateTimerQueries();
 	}
 
-	DLL_EXPORT void Compute_SetErrorMode(int mode)
+	DLL_EXPORT void Compute_StopTrace()
 	{
-		switch (mode) {
-			case ERROR_MODE_IGNORE:
-			case ERROR_MODE_REPORT_FIRST:
-			case ERROR_MODE_REPORT_ALL:
-			case ERROR_MODE_STOP:
-				errorMode = (ErrorMode)mode;
-				break;
+		TRACE_COMMAND();
 
-			default:
-				PluginError("Invalid error mode %d.", mode);
-				break;
+		if (!tracer.enabled) {
+			return;
 		}
+
+		CollectTimerQueries();
+		tracer.enabled = false;
+		UpdateTimerQueries();
 	}
 
-	DLL_EXPORT unsigned int Compute_LoadShaderFromString(char *shaderSource)
+	DLL_EXPORT void Compute_SaveTrace(char *traceFile)
 	{
-		GLuint shaderName = glCreateShader(GL_COMPUTE_SHADER);
-		if (!shaderName) {
-			switch (glGetError()) {
-				case GL_INVALID_ENUM: {
-					PluginError("Failed to create computer shader. Invalid shader type.");
-				}
-				default: {
-					PluginError("Failed to create computer shader. Unknown error.");
-				}
-			}
-			return 0;
-		}
+		TRACE_COMMAND();
 
-		char *fullShaderSource = GenerateFullShaderSource(shaderSource);
-
-		glShaderSource(shaderName, 1, &fullShaderSource, NULL);
-		switch (glGetError()) {
-			case GL_INVALID_VALUE: {
-				PluginError("Failed to load shader source. Invalid shader name.");
-				free(fullShaderSource);
-				return 0;
-			}
-			case GL_INVALID_OPERATION: {
-				PluginError("Failed to load shader source. Non-shader object provided as shader.");
-				free(fullShaderSource);
-				return 0;
-			}
+		if (tracer.enabled) {
+			CollectTimerQueries();
 		}
 
-		glCompileShader(shaderName);
-		switch (glGetError()) {
-			case GL_INVALID_VALUE: {
-				PluginError("Failed to load shader source. Invalid shader name.");
-				free(fullShaderSource);
-				return 0;
+		std::string json;
+		json.reserve(128 + tracer.events.size() * 96);
+		json += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+		json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+
+		char line[256];
+		for (size_t i = 0; i < tracer.events.size(); ++i) {
+			TraceEvent &event = tracer.events[i];
+			char const *name = event.name;
+			if (strncmp(name, "Compute_", 8) == 0) {
+				name += 8;
 			}
-			case GL_INVALID_OPERATION: {
-				PluginError("Failed to load shader source. Non-shader object provided as shader.");
-				free(fullShaderSource);
-				return 0;
+
+			// Chrome trace times are in microseconds.
+			double start = event.start / 1000.0;
+			switch (event.type) {
+				case TRACE_EVENT_CPU_SPAN:
+				case TRACE_EVENT_GPU_SPAN: {
+					int tid = event.type == TRACE_EVENT_CPU_SPAN ? 1 : 2;
+					snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", name, tid, start, event.duration / 1000.0);
+					break;
+				}
+				case TRACE_EVENT_COUNTER: {
+					snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"bytes\":%lld}}", name, start, event.value);
+					break;
+				}
+				case TRACE_EVENT_FRAME: {
+					snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,\"ts\":%.3f}", name, start);
+					break;
+				}
 			}
+			json += line;
 		}
-		GLint compileStatus;
-		glGetShaderiv(shaderName, GL_COMPILE_STATUS, &compileStatus);
-		if (compileStatus != GL_TRUE) {
-			GLint logLen;
-			glGetShaderiv(shaderName, GL_INFO_LOG_LENGTH, &logLen);
-			char *infoLogBuffer = (char *)malloc(logLen);
-			glGetShaderInfoLog(shaderName, logLen, NULL, infoLogBuffer);
-			PluginError("%s", infoLogBuffer);
-			free(infoLogBuffer);
-			glDeleteShader(shaderName);
-			free(fullShaderSource);
-			return 0;
+		json += "\n]}\n";
+
+		unsigned int memblockID = agk::CreateMemblock((int)json.size());
+		if (!memblockID) {
+			PluginError("Failed to save trace. Could not create a memblock of %u bytes.", (unsigned int)json.size());
+			return;
 		}
+		memcpy(agk::GetMemblockPtr(memblockID), json.data(), json.size());
+		agk::CreateFileFromMemblock(traceFile, memblockID);
+		agk::DeleteMemblock(memblockID);
+	}
 
-		GLuint programName = glCreateProgram();
-		if (!programName) {
-			PluginError("Failed to create shader program.");
-			glDeleteShader(shaderName);
-			free(fullShaderSource);
+	DLL_EXPORT unsigned int Compute_LoadShaderFromString(char *shaderSource)
+	{
+		TRACE_COMMAND();
+
+		return LoadShaderSource(shaderSource, NULL, NULL, false);
+	}
+
+	DLL_EXPORT unsigned int Compute_LoadShader(char *shaderFile)
+	{
+		TRACE_COMMAND();
+
+		char *sourceCode = ReadShaderFile(shaderFile);
+		if (!sourceCode) {
 			return 0;
 		}
 
-		glAttachShader(programName, shaderName);
-		switch (glGetError()) {
-			case GL_INVALID_VALUE: {
-				PluginError("Failed to attach shader. Invalid shader or program name.");
-				glDeleteShader(shaderName);
-				glDeleteProgram(programName);
-				free(fullShaderSource);
-				return 0;
-			}
-			case GL_INVALID_OPERATION: {
-				PluginError("Failed to attach shader. Non-program or non-shader object used, shader already attached, or shader of same type already attached.");
-				glDeleteShader(shaderName);
-				glDeleteProgram(programName);
-				free(fullShaderSource);
-				return 0;
-			}
-		}
+		unsigned int shaderID = LoadShaderSource(sourceCode, shaderFile, NULL, false);
+		free(sourceCode);
+		return shaderID;
+	}
 
-		glLinkProgram(programName);
-		GLint linkStatus;
-		glGetProgramiv(programName, GL_LINK_STATUS, &linkStatus);
-		if (linkStatus != GL_TRUE) {
-			GLint logLen;
-			glGetProgramiv(programName, GL_INFO_LOG_LENGTH, &logLen);
-			char *infoLogBuffer = (char *)malloc(logLen);
-			glGetProgramInfoLog(programName, logLen, NULL, infoLogBuffer);
-			PluginError("%s", infoLogBuffer);
-			free(infoLogBuffer);
-			glDeleteShader(shaderName);
-			glDeleteProgram(programName);
-			free(fullShaderSource);
+	DLL_EXPORT unsigned int Compute_LoadShaderVariant(char *shaderFile, char *defines)
+	{
+		TRACE_COMMAND();
+
+		char *sourceCode = ReadShaderFile(shaderFile);
+		if (!sourceCode) {
 			return 0;
 		}
-		
-		glDeleteShader(shaderName);
-		free(fullShaderSource);
 
-		unsigned int id = NextShaderID();
-		computeShaders[id] = new ComputeShader(programName);
-		return id;
+		unsigned int shaderID = LoadShaderSource(sourceCode, shaderFile, defines, false);
+		free(sourceCode);
+		return shaderID;
 	}
 
-	DLL_EXPORT unsigned int Compute_LoadShader(char *shaderFile)
+	DLL_EXPORT unsigned int Compute_LoadShaderSPIRV(char *shaderFile, char *entryPoint, unsigned int specConstantsMemblockID)
+	{
+		TRACE_COMMAND();
+
+		return LoadShaderSPIRV(shaderFile, entryPoint, specConstantsMemblockID);
+	}
+
+	DLL_EXPORT unsigned int Compute_LoadShaderAsync(char *shaderFile)
 	{
-		if (!agk::GetFileExists(shaderFile)) {
-			PluginError("Unable to load shader file '%s'.", shaderFile);
+		TRACE_COMMAND();
+
+		if (!CheckInit()) {
 			return 0;
 		}
 
-		unsigned file = agk::OpenToRead(shaderFile);
-		int size = agk::GetFileSize(file);
-		char *sourceCode = (char *)malloc(size + 2);
-		*sourceCode = '\0';
-		while (!agk::FileEOF(file)) {
-			char *line = agk::ReadLine(file);
-			strcat(sourceCode, line);
-			strcat(sourceCode, "\n");
-			agk::DeleteString(line);
+		char *sourceCode = ReadShaderFile(shaderFile);
+		if (!sourceCode) {
+			return 0;
 		}
-		agk::CloseFile(file);
-		unsigned int shaderID = Compute_LoadShaderFromString(sourceCode);
+
+		unsigned int shaderID = LoadShaderSource(sourceCode, shaderFile, NULL, true);
 		free(sourceCode);
 		return shaderID;
 	}
 
+	DLL_EXPORT int Compute_GetShaderStatus(unsigned int shaderID)
+	{
+		TRACE_COMMAND();
+
+		return GetShaderStatus(shaderID);
+	}
+
+	DLL_EXPORT int Compute_GetShaderReady(unsigned int shaderID)
+	{
+		TRACE_COMMAND();
+
+		return GetShaderStatus(shaderID) == 1 ? 1 : 0;
+	}
+
 	DLL_EXPORT void Compute_DeleteShader(unsigned int shaderID)
 	{
+		TRACE_COMMAND();
+
+		PendingShaderMap::iterator pendingIter = pendingShaders.find(shaderID);
+		if (pendingIter != pendingShaders.end()) {
+			PendingShader *pendingShader = pendingIter->second;
+			if (!pendingShader->failed) {
+				glDeleteShader(pendingShader->shaderName);
+				glDeleteProgram(pendingShader->programName);
+			}
+			delete pendingShader;
+			pendingShaders.erase(pendingIter);
+			computeShaders.release(shaderID);
+			return;
+		}
+
 		ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
 		if (iter == computeShaders.end()) {
 			PluginError("Attempting to delete non-existent shader %u.", shaderID);
 			return;
 		}
 
+		CancelShaderReload(shaderID);
+		InvalidateCommandLists(iter->second, NULL);
+		ForgetTimerQueries(iter->second, NULL);
 		delete iter->second;
 		computeShaders.erase(iter);
 	}
 
 	DLL_EXPORT void Compute_SetShaderImage(unsigned int shaderID, unsigned int imageID, unsigned int attachPoint)
 	{
+		TRACE_COMMAND();
+
+		FinishPendingShader(shaderID);
 		ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
 		if (iter == computeShaders.end()) {
 			PluginError("Failed to set shader image on unknown shader %u.", shaderID);
@@ -697,7 +3845,8 @@ extern "C"
 
 		if (imageID == 0) {
 			glBindImageTexture(attachPoint, 0, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
-			switch (glGetError()) {
+			stateCache.imageTextures[attachPoint] = 0;
+			switch (GetGLError()) {
 				case GL_INVALID_VALUE: {
 					PluginError("Failed to clear image from attach point %u on compute shader %u. Invalid attach point, texture name, level, or layer.", attachPoint, shaderID);
 					return;
@@ -712,46 +3861,179 @@ extern "C"
 
 	DLL_EXPORT void Compute_SetShaderConstantByLocation(unsigned int shaderID, unsigned int location, float v1, float v2, float v3, float v4)
 	{
+		TRACE_COMMAND();
+
 		SetShaderConstant(shaderID, location, 0, v1, v2, v3, v4);
 	}
 
 	DLL_EXPORT void Compute_SetShaderConstantByName(unsigned int shaderID, char *name, float v1, float v2, float v3, float v4)
 	{
+		TRACE_COMMAND();
+
 		SetShaderConstant(shaderID, name, 0, v1, v2, v3, v4);
 	}
 
 	DLL_EXPORT void Compute_SetShaderConstantIntByLocation(unsigned int shaderID, unsigned int location, int v1, int v2, int v3, int v4)
 	{
+		TRACE_COMMAND();
+
 		SetShaderConstant(shaderID, location, 0, v1, v2, v3, v4);
 	}
 
 	DLL_EXPORT void Compute_SetShaderConstantIntByName(unsigned int shaderID, char *name, int v1, int v2, int v3, int v4)
 	{
+		TRACE_COMMAND();
+
 		SetShaderConstant(shaderID, name, 0, v1, v2, v3, v4);
 	}
 
 	DLL_EXPORT void Compute_SetShaderConstantArrayByLocation(unsigned int shaderID, unsigned int location, int index, float v1, float v2, float v3, float v4)
 	{
+		TRACE_COMMAND();
+
 		SetShaderConstant(shaderID, location, index, v1, v2, v3, v4);
 	}
 
 	DLL_EXPORT void Compute_SetShaderConstantArrayByName(unsigned int shaderID, char *name, int index, float v1, float v2, float v3, float v4)
 	{
+		TRACE_COMMAND();
+
 		SetShaderConstant(shaderID, name, index, v1, v2, v3, v4);
 	}
 
 	DLL_EXPORT void Compute_SetShaderConstantArrayIntByLocation(unsigned int shaderID, unsigned int location, int index, int v1, int v2, int v3, int v4)
 	{
+		TRACE_COMMAND();
+
 		SetShaderConstant(shaderID, location, index, v1, v2, v3, v4);
 	}
 
-	DLL_EXPORT void Compute_SetShaderConstantArrayIntByName(unsigned int shaderID, char *name, int index, int v1, int v2, int v3, int v4)
+	DLL_EXPORT void Compute_SetShaderConstantArrayIntByName(unsigned int shaderID, char *name, int index, int v1, int v2, int v3, int v4)
+	{
+		TRACE_COMMAND();
+
+		SetShaderConstant(shaderID, name, index, v1, v2, v3, v4);
+	}
+
+	DLL_EXPORT void Compute_SetShaderConstantArrayFromMemblockByLocation(unsigned int shaderID, unsigned int location, unsigned int memblockID, int offset, int count)
+	{
+		TRACE_COMMAND();
+
+		SetShaderConstantArrayFromMemblock(shaderID, location, memblockID, offset, count);
+	}
+
+	DLL_EXPORT void Compute_SetShaderConstantArrayFromMemblockByName(unsigned int shaderID, char *name, unsigned int memblockID, int offset, int count)
+	{
+		TRACE_COMMAND();
+
+		SetShaderConstantArrayFromMemblock(shaderID, name, memblockID, offset, count);
+	}
+
+	DLL_EXPORT void Compute_SetShaderConstantArrayFromMemblockByHandle(unsigned int shaderID, unsigned int handle, unsigned int memblockID, int offset, int count)
+	{
+		TRACE_COMMAND();
+
+		UniformHandle uniformHandle = { handle };
+		SetShaderConstantArrayFromMemblock(shaderID, uniformHandle, memblockID, offset, count);
+	}
+
+	DLL_EXPORT void Compute_ShareShaderConstantBlock(unsigned int shaderID, char *blockName, unsigned int sourceShaderID)
+	{
+		TRACE_COMMAND();
+
+		FinishPendingShader(shaderID);
+		FinishPendingShader(sourceShaderID);
+		ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
+		if (iter == computeShaders.end()) {
+			PluginError("Attempting to share constant block with unknown shader %u.", shaderID);
+			return;
+		}
+		ComputerShaderMap::iterator sourceIter = computeShaders.find(sourceShaderID);
+		if (sourceIter == computeShaders.end()) {
+			PluginError("Attempting to share constant block from unknown shader %u.", sourceShaderID);
+			return;
+		}
+
+		UniformBlock *block = iter->second->findBlock(blockName);
+		if (!block) {
+			PluginError("Failed to find constant block '%s' in shader %u.", blockName, shaderID);
+			return;
+		}
+		UniformBlock *sourceBlock = sourceIter->second->findBlock(blockName);
+		if (!sourceBlock) {
+			PluginError("Failed to find constant block '%s' in shader %u.", blockName, sourceShaderID);
+			return;
+		}
+
+		if (block->buffer->size != sourceBlock->buffer->size) {
+			PluginError("Failed to share constant block '%s' between shaders %u and %u. The block is a different size in each shader.", blockName, sourceShaderID, shaderID);
+			return;
+		}
+
+		if (block->buffer != sourceBlock->buffer) {
+			iter->second->shareBlock(block, sourceBlock->buffer);
+		}
+	}
+
+	DLL_EXPORT unsigned int Compute_GetShaderConstantHandle(unsigned int shaderID, char *name)
+	{
+		TRACE_COMMAND();
+
+		FinishPendingShader(shaderID);
+		ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
+		if (iter == computeShaders.end()) {
+			PluginError("Attempting to get constant handle from unknown shader %u.", shaderID);
+			return 0;
+		}
+
+		ComputeShader *computeShader = iter->second;
+		Uniform *uniform = computeShader->findUniform(name);
+		if (!uniform) {
+			PluginError(SetShaderConstantError<char *>::format, name, shaderID);
+			return 0;
+		}
+
+		return computeShader->getHandle(uniform);
+	}
+
+	DLL_EXPORT void Compute_SetShaderConstantByHandle(unsigned int shaderID, unsigned int handle, float v1, float v2, float v3, float v4)
+	{
+		TRACE_COMMAND();
+
+		UniformHandle uniformHandle = { handle };
+		SetShaderConstant(shaderID, uniformHandle, 0, v1, v2, v3, v4);
+	}
+
+	DLL_EXPORT void Compute_SetShaderConstantIntByHandle(unsigned int shaderID, unsigned int handle, int v1, int v2, int v3, int v4)
+	{
+		TRACE_COMMAND();
+
+		UniformHandle uniformHandle = { handle };
+		SetShaderConstant(shaderID, uniformHandle, 0, v1, v2, v3, v4);
+	}
+
+	DLL_EXPORT void Compute_SetShaderConstantArrayByHandle(unsigned int shaderID, unsigned int handle, int index, float v1, float v2, float v3, float v4)
+	{
+		TRACE_COMMAND();
+
+		UniformHandle uniformHandle = { handle };
+		SetShaderConstant(shaderID, uniformHandle, index, v1, v2, v3, v4);
+	}
+
+	DLL_EXPORT void Compute_SetShaderConstantArrayIntByHandle(unsigned int shaderID, unsigned int handle, int index, int v1, int v2, int v3, int v4)
 	{
-		SetShaderConstant(shaderID, name, index, v1, v2, v3, v4);
+		TRACE_COMMAND();
+
+		UniformHandle uniformHandle = { handle };
+		SetShaderConstant(shaderID, uniformHandle, index, v1, v2, v3, v4);
 	}
 
 	DLL_EXPORT void Compute_RunShader(unsigned int shaderID, int numGroupsX, int numGroupsY, int numGroupsZ)
 	{
+		TRACE_COMMAND();
+
+		UpdateShaderWatch();
+		FinishPendingShader(shaderID);
 		ComputerShaderMap::iterator iter = computeShaders.find((unsigned)shaderID);
 		if (iter == computeShaders.end()) {
 			PluginError("Attempting to run unknown shader %u.", shaderID);
@@ -765,95 +4047,92 @@ extern "C"
 			return;
 		}
 
-		GLint agkProgramName;
-		glGetIntegerv(GL_CURRENT_PROGRAM, &agkProgramName);
+		computeShader->setInvocationCount(numGroupsX * computeShader->localSize[0], numGroupsY * computeShader->localSize[1], numGroupsZ * computeShader->localSize[2]);
 
-		glUseProgram(computeShader->programName);
-		switch (glGetError()) {
-			case GL_INVALID_VALUE: {
-				PluginError("Failed to run shader. Unknown program.");
-				goto exit_run_shader;
-			}
-			case GL_INVALID_OPERATION: {
-				PluginError("Failed to run shader. Non-program object used, or unable to make program part of current state.");
-				goto exit_run_shader;
-			}
+		if (recordingList) {
+			RecordDispatch(shaderID, computeShader, numGroupsX, numGroupsY, numGroupsZ, NULL, 0);
+			return;
 		}
 
-		for (GLuint attachPoint = 0; attachPoint < MAX_IMAGE_BINDINGS; ++attachPoint) {
-			if (computeShader->imageBindings[attachPoint] != 0) {
-				unsigned int imageID = computeShader->imageBindings[attachPoint];
-				AGK::cImage *image = agk::GetImagePtr(imageID);
-				if (!image) {
-					PluginError("Failed to attach image %u to computer shader. Has this image been deleted?", imageID);
-					goto exit_run_shader;
-				}
+		DispatchShader(computeShader, numGroupsX, numGroupsY, numGroupsZ, NULL, 0);
+	}
 
-				glBindImageTexture(attachPoint, image->m_iTextureID, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
-				switch (glGetError()) {
-					case GL_INVALID_VALUE: {
-						PluginError("Failed to attach image %u to computer shader. Invalid attach point, texture name, level, or layer.", imageID);
-						goto exit_run_shader;
-					}
-					case GL_INVALID_ENUM: {
-						PluginError("Failed to attach image %u to computer shader. Invalid format or access settings.", imageID);
-						goto exit_run_shader;
-					}
-				}
-			}
+	DLL_EXPORT void Compute_RunShaderForCount(unsigned int shaderID, int countX, int countY, int countZ)
+	{
+		TRACE_COMMAND();
+
+		UpdateShaderWatch();
+		FinishPendingShader(shaderID);
+		ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
+		if (iter == computeShaders.end()) {
+			PluginError("Attempting to run unknown shader %u.", shaderID);
+			return;
 		}
 
-		for (unsigned int i = 0; i < MAX_BUFFER_BINDINGS; ++i) {
-			if (computeShader->bufferBindings[i].bufferID == 0) {
-				break;
-			}
+		ComputeShader *computeShader = iter->second;
 
-			BufferObjectMap::iterator iter = bufferObjects.find(computeShader->bufferBindings[i].bufferID);
-			if (iter == bufferObjects.end()) {
-				PluginError("Failed to bind non-existent buffer %u. Has this buffer been deleted?", computeShader->bufferBindings[i].bufferID);
-				goto exit_run_shader;
-			}
+		if (countX <= 0 || countY <= 0 || countZ <= 0) {
+			PluginError("Invalid invocation counts specified (%d, %d, %d) for running compute shader %u. Each dimension must be >= 1.", countX, countY, countZ, shaderID);
+			return;
+		}
 
-			BufferObject *bufferObject = iter->second;
+		int numGroupsX = (countX + computeShader->localSize[0] - 1) / computeShader->localSize[0];
+		int numGroupsY = (countY + computeShader->localSize[1] - 1) / computeShader->localSize[1];
+		int numGroupsZ = (countZ + computeShader->localSize[2] - 1) / computeShader->localSize[2];
 
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, computeShader->bufferBindings[i].bindingPoint, bufferObject->bufferName);
-			switch (glGetError()) {
-				case GL_INVALID_ENUM: {
-					PluginError("Failed to bind buffer. Invalid target.");
-					goto exit_run_shader;
-				}
-				case GL_INVALID_VALUE: {
-					PluginError("Failed to bind buffer. Invalid binding point or empty buffer used.");
-					goto exit_run_shader;
-				}
-			}
+		computeShader->setInvocationCount(countX, countY, countZ);
+
+		if (recordingList) {
+			RecordDispatch(shaderID, computeShader, numGroupsX, numGroupsY, numGroupsZ, NULL, 0);
+			return;
 		}
 
-		for (GLuint i = 0; i < computeShader->numUniforms; ++i) {
-			Uniform *uniform = computeShader->getUniform(i);
-			if (uniform->dirty) {
-				uniform->apply();
-			}
+		DispatchShader(computeShader, numGroupsX, numGroupsY, numGroupsZ, NULL, 0);
+	}
+
+	DLL_EXPORT void Compute_RunShaderIndirect(unsigned int shaderID, unsigned int bufferID, int byteOffset)
+	{
+		TRACE_COMMAND();
+
+		UpdateShaderWatch();
+		FinishPendingShader(shaderID);
+		ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
+		if (iter == computeShaders.end()) {
+			PluginError("Attempting to run unknown shader %u.", shaderID);
+			return;
 		}
 
-		glDispatchCompute(numGroupsX, numGroupsY, numGroupsZ);
-		switch (glGetError()) {
-			case GL_INVALID_VALUE: {
-				PluginError("Failed to run shader. Too many global work groups requested.");
-				goto exit_run_shader;
-			}
-			case GL_INVALID_OPERATION: {
-				PluginError("Failed to run shader. No active compute shader found.");
-				goto exit_run_shader;
-			}
+		ComputeShader *computeShader = iter->second;
+
+		BufferObjectMap::iterator bufferIter = bufferObjects.find(bufferID);
+		if (bufferIter == bufferObjects.end()) {
+			PluginError("Attempting to run shader %u with work group counts from non-existent buffer %u.", shaderID, bufferID);
+			return;
 		}
 
-exit_run_shader:
-		glUseProgram(agkProgramName);
+		BufferObject *bufferObject = bufferIter->second;
+
+		if (byteOffset % 4 != 0 || !IsValidRange(byteOffset, 3 * sizeof(GLuint), bufferObject->bufferSize)) {
+			PluginError("Invalid offset %d for work group counts in buffer %u. The offset must be a multiple of 4, and leave room for 3 integers in the buffer.", byteOffset, bufferID);
+			return;
+		}
+
+		// The number of invocations is only known to the GPU, so agk_InvocationCount is set to a count that every
+		// invocation is within, rather than left at the count the shader was last run for.
+		computeShader->setInvocationCount(INT_MAX, INT_MAX, INT_MAX);
+
+		if (recordingList) {
+			RecordDispatch(shaderID, computeShader, 0, 0, 0, bufferObject, byteOffset);
+			return;
+		}
+
+		DispatchShader(computeShader, 0, 0, 0, bufferObject, byteOffset);
 	}
 
 	DLL_EXPORT unsigned int Compute_CreateBuffer(int size)
 	{
+		TRACE_COMMAND();
+
 		if (size <= 0) {
 			PluginError("Failed to create buffer of size %d. Buffer size must be greater than 0.", size);
 			return 0;
@@ -861,8 +4140,25 @@ exit_run_shader:
 		return CreateBuffer((GLsizei)size, NULL);
 	}
 
+	DLL_EXPORT unsigned int Compute_CreatePersistentBuffer(int size, int flags)
+	{
+		TRACE_COMMAND();
+
+		if (size <= 0) {
+			PluginError("Failed to create persistent buffer of size %d. Buffer size must be greater than 0.", size);
+			return 0;
+		}
+		if (flags < PERSISTENT_BUFFER_READ || flags > (PERSISTENT_BUFFER_READ | PERSISTENT_BUFFER_WRITE)) {
+			PluginError("Failed to create persistent buffer with invalid flags %d. Flags must be 1 (read), 2 (write), or 3 (read and write).", flags);
+			return 0;
+		}
+		return CreatePersistentBuffer((GLsizei)size, flags);
+	}
+
 	DLL_EXPORT unsigned int Compute_CreateBufferFromMemblock(unsigned int memblockID)
 	{
+		TRACE_COMMAND();
+
 		unsigned char *data = agk::GetMemblockPtr(memblockID);
 		if (!data) {
 			PluginError("Failed to create buffer from unknown memblock %u.", memblockID);
@@ -880,12 +4176,16 @@ exit_run_shader:
 
 	DLL_EXPORT void Compute_DeleteBuffer(unsigned int bufferID)
 	{
+		TRACE_COMMAND();
+
 		BufferObjectMap::iterator iter = bufferObjects.find(bufferID);
 		if (iter == bufferObjects.end()) {
 			PluginError("Attempting to delete non-existent buffer %u.", bufferID);
 			return;
 		}
 
+		InvalidateCommandLists(NULL, iter->second);
+		ForgetStorageBuffer(iter->second->bufferName);
 		delete iter->second;
 		
 		bufferObjects.erase(iter);
@@ -893,6 +4193,8 @@ exit_run_shader:
 
 	DLL_EXPORT int Compute_GetBufferSize(unsigned int bufferID)
 	{
+		TRACE_COMMAND();
+
 		BufferObjectMap::iterator iter = bufferObjects.find(bufferID);
 		if (iter == bufferObjects.end()) {
 			PluginError("Attempting to get size of non-existent buffer %u.", bufferID);
@@ -904,6 +4206,9 @@ exit_run_shader:
 
 	DLL_EXPORT void Compute_SetShaderBuffer(unsigned int shaderID, unsigned int bufferID, unsigned int bindingPoint)
 	{
+		TRACE_COMMAND();
+
+		FinishPendingShader(shaderID);
 		ComputerShaderMap::iterator iter = computeShaders.find(shaderID);
 		if (iter == computeShaders.end()) {
 			PluginError("Failed to set shader buffer on unknown shader %u.", shaderID);
@@ -946,7 +4251,8 @@ exit_run_shader:
 						computeShader->bufferBindings[i].bufferID = 0;
 					}
 					glBindBufferBase(GL_SHADER_STORAGE_BUFFER, computeShader->bufferBindings[i].bindingPoint, 0);
-					switch (glGetError()) {
+					*CachedStorageBinding(computeShader->bufferBindings[i].bindingPoint) = 0;
+					switch (GetGLError()) {
 						case GL_INVALID_ENUM: {
 							PluginError("Failed to clear buffer from binding point %u on shader %u. Invalid target.", bindingPoint, shaderID);
 							return;
@@ -967,69 +4273,297 @@ exit_run_shader:
 
 	DLL_EXPORT unsigned int Compute_CreateMemblockFromBuffer(unsigned int bufferID)
 	{
+		TRACE_COMMAND();
+
 		BufferObjectMap::iterator iter = bufferObjects.find(bufferID);
 		if (iter == bufferObjects.end()) {
 			PluginError("Failed to create memblock from unknown buffer %u.", bufferID);
 			return 0;
 		}
 
-		BufferObject *bufferObject = iter->second;
+		BufferObject *bufferObject = iter->second;
+
+		if (bufferObject->mappedData) {
+			if (!(bufferObject->persistentFlags & PERSISTENT_BUFFER_READ)) {
+				PluginError("Failed to create memblock from persistent buffer %u, as it was not created with the read flag.", bufferID);
+				return 0;
+			}
+			if (!bufferObject->waitForGPU()) {
+				PluginError("Failed to create memblock from buffer. Waiting for the GPU failed.");
+				return 0;
+			}
+			unsigned int memblockID = agk::CreateMemblock(bufferObject->bufferSize);
+			long long copyStart = TraceBegin();
+			memcpy(agk::GetMemblockPtr(memblockID), bufferObject->mappedData, bufferObject->bufferSize);
+			TraceEnd("Memcpy", copyStart);
+			TraceTransfer(false, bufferObject->bufferSize);
+			return memblockID;
+		}
+
+		SyncBufferForTransfer(bufferObject);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferObject->bufferName);
+		switch (GetGLError()) {
+			case GL_INVALID_ENUM: {
+				PluginError("Failed to create memblock from buffer. Invalid target.");
+				return 0;
+			}
+			case GL_INVALID_VALUE: {
+				PluginError("Failed to create memblock from buffer. Unknown buffer name.");
+				return 0;
+			}
+		}
+
+		long long mapStart = TraceBegin();
+		void *data = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
+		TraceEnd("Map", mapStart);
+		switch (GetGLError()) {
+			case GL_INVALID_ENUM: {
+				PluginError("Failed to create memblock from buffer. Invalid target or access type.");
+				return 0;
+			}
+			case GL_INVALID_OPERATION: {
+				PluginError("Failed to create memblock from buffer. Target not bound to buffer or already mapped.");
+				return 0;
+			}
+			case GL_OUT_OF_MEMORY: {
+				PluginError("Failed to create memblock from buffer. Insufficient memory available.");
+				return 0;
+			}
+		}
+		if (!data) {
+			PluginError("Failed to create memblock from buffer. Unable to map buffer for reading.");
+			return 0;
+		}
+
+		unsigned int memblockID = agk::CreateMemblock(bufferObject->bufferSize);
+		void *memblockPtr = (void *)agk::GetMemblockPtr(memblockID);
+
+		long long copyStart = TraceBegin();
+		memcpy(memblockPtr, data, bufferObject->bufferSize);
+		TraceEnd("Memcpy", copyStart);
+		TraceTransfer(false, bufferObject->bufferSize);
+
+		long long unmapStart = TraceBegin();
+		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		TraceEnd("Unmap", unmapStart);
+		switch (GetGLError()) {
+			case GL_INVALID_ENUM: {
+				agk::DeleteMemblock(memblockID);
+				PluginError("Failed to create memblock from buffer. Invalid target.");
+				return 0;
+			}
+			case GL_INVALID_OPERATION: {
+				agk::DeleteMemblock(memblockID);
+				PluginError("Failed to create memblock from buffer. Target not bound, or is not mapped.");
+				return 0;
+			}
+		}
+
+		return memblockID;
+	}
+
+	DLL_EXPORT void Compute_UpdateBufferFromMemblock(unsigned int bufferID, unsigned int memblockID)
+	{
+		TRACE_COMMAND();
+
+		BufferObjectMap::iterator iter = bufferObjects.find(bufferID);
+		if (iter == bufferObjects.end()) {
+			PluginError("Failed to update unknown buffer %u.", bufferID);
+			return;
+		}
+
+		BufferObject *bufferObject = iter->second;
+
+		unsigned char *data = agk::GetMemblockPtr(memblockID);
+		if (!data) {
+			PluginError("Failed to update buffer from unknown memblock %u.", memblockID);
+			return;
+		}
+
+		GLsizei size = (GLsizei)agk::GetMemblockSize(memblockID);
+		if (size == 0) {
+			PluginError("Failed to update buffer from a memblock with size 0.");
+			return;
+		}
+
+		if (recordingList) {
+			if (size > bufferObject->bufferSize) {
+				PluginError("Failed to record update of buffer %u. Memblock is %u bytes and buffers cannot grow beyond their %u bytes while recording a command list.", bufferID, size, bufferObject->bufferSize);
+				return;
+			}
+			RecordTransfer(COMMAND_UPDATE_BUFFER, bufferID, bufferObject, memblockID, 0, 0, size);
+			return;
+		}
+
+		if (bufferObject->mappedData) {
+			if (!(bufferObject->persistentFlags & PERSISTENT_BUFFER_WRITE)) {
+				PluginError("Failed to update persistent buffer %u, as it was not created with the write flag.", bufferID);
+				return;
+			}
+			if (size > bufferObject->bufferSize) {
+				PluginError("Failed to update persistent buffer %u. Memblock is %u bytes and persistent buffers cannot grow beyond their %u bytes.", bufferID, size, bufferObject->bufferSize);
+				return;
+			}
+			if (!bufferObject->waitForGPU()) {
+				PluginError("Failed to update buffer. Waiting for the GPU failed.");
+				return;
+			}
+			long long copyStart = TraceBegin();
+			memcpy(bufferObject->mappedData, data, size);
+			TraceEnd("Memcpy", copyStart);
+			TraceTransfer(true, size);
+			return;
+		}
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferObject->bufferName);
+		switch (GetGLError()) {
+			case GL_INVALID_ENUM: {
+				PluginError("Failed to update buffer. Invalid target.");
+				return;
+			}
+			case GL_INVALID_VALUE: {
+				PluginError("Failed to update buffer. Unknown buffer name.");
+				return;
+			}
+		}
+
+		long long uploadStart = TraceBegin();
+		glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STATIC_COPY);
+		TraceEnd("Upload", uploadStart);
+		TraceTransfer(true, size);
+		switch (GetGLError()) {
+			case GL_INVALID_ENUM: {
+				PluginError("Failed to update buffer. Invalid target or usage.");
+				return;
+			}
+			case GL_INVALID_VALUE: {
+				PluginError("Failed to update buffer. Invalid memblock size.");
+				return;
+			}
+			case GL_INVALID_OPERATION: {
+				PluginError("Failed to update buffer. Unknown or immutable buffer object used.");
+				return;
+			}
+			case GL_OUT_OF_MEMORY: {
+				PluginError("Failed to update buffer. Insufficient memory available.");
+				return;
+			}
+		}
+
+		bufferObject->bufferSize = size;
+	}
+
+	DLL_EXPORT void Compute_CopyBufferToMemblock(unsigned int bufferID, unsigned int memblockID)
+	{
+		TRACE_COMMAND();
+
+		BufferObjectMap::iterator iter = bufferObjects.find(bufferID);
+		if (iter == bufferObjects.end()) {
+			PluginError("Failed to copy unknown buffer %u to memblock %u.", bufferID, memblockID);
+			return;
+		}
+
+		BufferObject *bufferObject = iter->second;
+
+		unsigned char *memblockPtr = agk::GetMemblockPtr(memblockID);
+		if (!memblockPtr) {
+			PluginError("Failed to copy buffer %u to unknown memblock %u.", bufferID, memblockID);
+			return;
+		}
+
+		GLsizei size = (GLsizei)agk::GetMemblockSize(memblockID);
+		if (size < bufferObject->bufferSize) {
+			PluginError("Insufficient space in memblock to copy from buffer. Memblock is %u bytes and buffer is %u bytes.", size, bufferObject->bufferSize);
+			return;
+		}
+
+		if (recordingList) {
+			RecordTransfer(COMMAND_COPY_BUFFER, bufferID, bufferObject, memblockID, 0, 0, bufferObject->bufferSize);
+			return;
+		}
+
+		if (bufferObject->mappedData) {
+			if (!(bufferObject->persistentFlags & PERSISTENT_BUFFER_READ)) {
+				PluginError("Failed to copy persistent buffer %u to memblock, as it was not created with the read flag.", bufferID);
+				return;
+			}
+			if (!bufferObject->waitForGPU()) {
+				PluginError("Failed to copy buffer to memblock. Waiting for the GPU failed.");
+				return;
+			}
+			long long copyStart = TraceBegin();
+			memcpy(memblockPtr, bufferObject->mappedData, bufferObject->bufferSize);
+			TraceEnd("Memcpy", copyStart);
+			TraceTransfer(false, bufferObject->bufferSize);
+			return;
+		}
+
+		SyncBufferForTransfer(bufferObject);
 
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferObject->bufferName);
-		switch (glGetError()) {
+		switch (GetGLError()) {
 			case GL_INVALID_ENUM: {
-				PluginError("Failed to create memblock from buffer. Invalid target.");
-				return 0;
+				PluginError("Failed to copy buffer to memblock. Invalid target.");
+				return;
 			}
 			case GL_INVALID_VALUE: {
-				PluginError("Failed to create memblock from buffer. Unknown buffer name.");
-				return 0;
+				PluginError("Failed to copy buffer to memblock. Unknown buffer name.");
+				return;
 			}
 		}
 
+		long long mapStart = TraceBegin();
 		void *data = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-		switch (glGetError()) {
+		TraceEnd("Map", mapStart);
+		switch (GetGLError()) {
 			case GL_INVALID_ENUM: {
-				PluginError("Failed to create memblock from buffer. Invalid target or access type.");
-				return 0;
+				PluginError("Failed to copy buffer to memblock. Invalid target or access type.");
+				return;
 			}
 			case GL_INVALID_OPERATION: {
-				PluginError("Failed to create memblock from buffer. Target not bound to buffer or already mapped.");
-				return 0;
+				PluginError("Failed to copy buffer to memblock. Target not bound to buffer or already mapped.");
+				return;
 			}
 			case GL_OUT_OF_MEMORY: {
-				PluginError("Failed to create memblock from buffer. Insufficient memory available.");
-				return 0;
+				PluginError("Failed to copy buffer to memblock. Insufficient memory available.");
+				return;
 			}
 		}
+		if (!data) {
+			PluginError("Failed to copy buffer to memblock. Unable to map buffer for reading.");
+			return;
+		}
 
-		unsigned int memblockID = agk::CreateMemblock(bufferObject->bufferSize);
-		void *memblockPtr = (void *)agk::GetMemblockPtr(memblockID);
-
+		long long copyStart = TraceBegin();
 		memcpy(memblockPtr, data, bufferObject->bufferSize);
+		TraceEnd("Memcpy", copyStart);
+		TraceTransfer(false, bufferObject->bufferSize);
 
+		long long unmapStart = TraceBegin();
 		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-		switch (glGetError()) {
+		TraceEnd("Unmap", unmapStart);
+		switch (GetGLError()) {
 			case GL_INVALID_ENUM: {
 				agk::DeleteMemblock(memblockID);
-				PluginError("Failed to create memblock from buffer. Invalid target.");
-				return 0;
+				PluginError("Failed to copy buffer to memblock. Invalid target.");
+				return;
 			}
 			case GL_INVALID_OPERATION: {
 				agk::DeleteMemblock(memblockID);
-				PluginError("Failed to create memblock from buffer. Target not bound, or is not mapped.");
-				return 0;
+				PluginError("Failed to copy buffer to memblock. Target not bound, or is not mapped.");
+				return;
 			}
 		}
-
-		return memblockID;
 	}
 
-	DLL_EXPORT void Compute_UpdateBufferFromMemblock(unsigned int bufferID, unsigned int memblockID)
+	DLL_EXPORT void Compute_UpdateBufferRange(unsigned int bufferID, unsigned int memblockID, int srcOffset, int dstOffset, int size)
 	{
+		TRACE_COMMAND();
+
 		BufferObjectMap::iterator iter = bufferObjects.find(bufferID);
 		if (iter == bufferObjects.end()) {
-			PluginError("Failed to update unknown buffer %u.", bufferID);
+			PluginError("Failed to update range of unknown buffer %u.", bufferID);
 			return;
 		}
 
@@ -1037,56 +4571,78 @@ exit_run_shader:
 
 		unsigned char *data = agk::GetMemblockPtr(memblockID);
 		if (!data) {
-			PluginError("Failed to update buffer from unknown memblock %u.", memblockID);
+			PluginError("Failed to update buffer range from unknown memblock %u.", memblockID);
 			return;
 		}
 
-		GLsizei size = (GLsizei)agk::GetMemblockSize(memblockID);
-		if (size == 0) {
-			PluginError("Failed to update buffer from a memblock with size 0.");
+		if (!IsValidRange(srcOffset, size, agk::GetMemblockSize(memblockID))) {
+			PluginError("Failed to update buffer range. %d bytes at offset %d is outside of memblock %u, which is %d bytes.", size, srcOffset, memblockID, agk::GetMemblockSize(memblockID));
 			return;
 		}
 
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferObject->bufferName);
-		switch (glGetError()) {
-			case GL_INVALID_ENUM: {
-				PluginError("Failed to update buffer. Invalid target.");
+		if (!IsValidRange(dstOffset, size, bufferObject->bufferSize)) {
+			PluginError("Failed to update buffer range. %d bytes at offset %d is outside of buffer %u, which is %d bytes.", size, dstOffset, bufferID, bufferObject->bufferSize);
+			return;
+		}
+
+		if (recordingList) {
+			RecordTransfer(COMMAND_UPDATE_BUFFER, bufferID, bufferObject, memblockID, dstOffset, srcOffset, size);
+			return;
+		}
+
+		if (bufferObject->mappedData) {
+			if (!(bufferObject->persistentFlags & PERSISTENT_BUFFER_WRITE)) {
+				PluginError("Failed to update range of persistent buffer %u, as it was not created with the write flag.", bufferID);
 				return;
 			}
-			case GL_INVALID_VALUE: {
-				PluginError("Failed to update buffer. Unknown buffer name.");
+			if (!bufferObject->waitForGPU()) {
+				PluginError("Failed to update buffer range. Waiting for the GPU failed.");
 				return;
 			}
+			long long copyStart = TraceBegin();
+			memcpy((unsigned char *)bufferObject->mappedData + dstOffset, data + srcOffset, size);
+			TraceEnd("Memcpy", copyStart);
+			TraceTransfer(true, size);
+			return;
 		}
 
-		glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STATIC_COPY);
-		switch (glGetError()) {
+		SyncBufferForTransfer(bufferObject);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferObject->bufferName);
+		switch (GetGLError()) {
 			case GL_INVALID_ENUM: {
-				PluginError("Failed to update buffer. Invalid target or usage.");
+				PluginError("Failed to update buffer range. Invalid target.");
 				return;
 			}
 			case GL_INVALID_VALUE: {
-				PluginError("Failed to update buffer. Invalid memblock size.");
+				PluginError("Failed to update buffer range. Unknown buffer name.");
 				return;
 			}
-			case GL_INVALID_OPERATION: {
-				PluginError("Failed to update buffer. Unknown or immutable buffer object used.");
+		}
+
+		long long uploadStart = TraceBegin();
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, dstOffset, size, data + srcOffset);
+		TraceEnd("Upload", uploadStart);
+		TraceTransfer(true, size);
+		switch (GetGLError()) {
+			case GL_INVALID_VALUE: {
+				PluginError("Failed to update buffer range. Invalid offset or size.");
 				return;
 			}
-			case GL_OUT_OF_MEMORY: {
-				PluginError("Failed to update buffer. Insufficient memory available.");
+			case GL_INVALID_OPERATION: {
+				PluginError("Failed to update buffer range. Buffer is mapped or immutable.");
 				return;
 			}
 		}
-
-		bufferObject->bufferSize = size;
 	}
 
-	DLL_EXPORT void Compute_CopyBufferToMemblock(unsigned int bufferID, unsigned int memblockID)
+	DLL_EXPORT void Compute_CopyBufferRangeToMemblock(unsigned int bufferID, unsigned int memblockID, int srcOffset, int dstOffset, int size)
 	{
+		TRACE_COMMAND();
+
 		BufferObjectMap::iterator iter = bufferObjects.find(bufferID);
 		if (iter == bufferObjects.end()) {
-			PluginError("Failed to copy unknown buffer %u to memblock %u.", bufferID, memblockID);
+			PluginError("Failed to copy range of unknown buffer %u to memblock %u.", bufferID, memblockID);
 			return;
 		}
 
@@ -1094,63 +4650,371 @@ exit_run_shader:
 
 		unsigned char *memblockPtr = agk::GetMemblockPtr(memblockID);
 		if (!memblockPtr) {
-			PluginError("Failed to copy buffer %u to unknown memblock %u.", bufferID, memblockID);
+			PluginError("Failed to copy range of buffer %u to unknown memblock %u.", bufferID, memblockID);
 			return;
 		}
 
-		GLsizei size = (GLsizei)agk::GetMemblockSize(memblockID);
-		if (size < bufferObject->bufferSize) {
-			PluginError("Insufficient space in memblock to copy from buffer. Memblock is %u bytes and buffer is %u bytes.", size, bufferObject->bufferSize);
+		if (!IsValidRange(srcOffset, size, bufferObject->bufferSize)) {
+			PluginError("Failed to copy buffer range to memblock. %d bytes at offset %d is outside of buffer %u, which is %d bytes.", size, srcOffset, bufferID, bufferObject->bufferSize);
+			return;
+		}
+
+		if (!IsValidRange(dstOffset, size, agk::GetMemblockSize(memblockID))) {
+			PluginError("Failed to copy buffer range to memblock. %d bytes at offset %d is outside of memblock %u, which is %d bytes.", size, dstOffset, memblockID, agk::GetMemblockSize(memblockID));
+			return;
+		}
+
+		if (recordingList) {
+			RecordTransfer(COMMAND_COPY_BUFFER, bufferID, bufferObject, memblockID, srcOffset, dstOffset, size);
+			return;
+		}
+
+		if (bufferObject->mappedData) {
+			if (!(bufferObject->persistentFlags & PERSISTENT_BUFFER_READ)) {
+				PluginError("Failed to copy range of persistent buffer %u to memblock, as it was not created with the read flag.", bufferID);
+				return;
+			}
+			if (!bufferObject->waitForGPU()) {
+				PluginError("Failed to copy buffer range to memblock. Waiting for the GPU failed.");
+				return;
+			}
+			long long copyStart = TraceBegin();
+			memcpy(memblockPtr + dstOffset, (unsigned char *)bufferObject->mappedData + srcOffset, size);
+			TraceEnd("Memcpy", copyStart);
+			TraceTransfer(false, size);
 			return;
 		}
 
+		SyncBufferForTransfer(bufferObject);
+
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferObject->bufferName);
-		switch (glGetError()) {
+		switch (GetGLError()) {
 			case GL_INVALID_ENUM: {
-				PluginError("Failed to copy buffer to memblock. Invalid target.");
+				PluginError("Failed to copy buffer range to memblock. Invalid target.");
 				return;
 			}
 			case GL_INVALID_VALUE: {
-				PluginError("Failed to copy buffer to memblock. Unknown buffer name.");
+				PluginError("Failed to copy buffer range to memblock. Unknown buffer name.");
 				return;
 			}
 		}
 
-		void *data = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-		switch (glGetError()) {
-			case GL_INVALID_ENUM: {
-				PluginError("Failed to copy buffer to memblock. Invalid target or access type.");
+		long long mapStart = TraceBegin();
+		void *data = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, srcOffset, size, GL_MAP_READ_BIT);
+		TraceEnd("Map", mapStart);
+		switch (GetGLError()) {
+			case GL_INVALID_VALUE: {
+				PluginError("Failed to copy buffer range to memblock. Invalid offset or size.");
 				return;
 			}
 			case GL_INVALID_OPERATION: {
-				PluginError("Failed to copy buffer to memblock. Target not bound to buffer or already mapped.");
+				PluginError("Failed to copy buffer range to memblock. Buffer already mapped.");
 				return;
 			}
 			case GL_OUT_OF_MEMORY: {
-				PluginError("Failed to copy buffer to memblock. Insufficient memory available.");
+				PluginError("Failed to copy buffer range to memblock. Insufficient memory available.");
 				return;
 			}
 		}
+		if (!data) {
+			PluginError("Failed to copy buffer range to memblock. Unable to map buffer for reading.");
+			return;
+		}
 
-		memcpy(memblockPtr, data, bufferObject->bufferSize);
+		long long copyStart = TraceBegin();
+		memcpy(memblockPtr + dstOffset, data, size);
+		TraceEnd("Memcpy", copyStart);
+		TraceTransfer(false, size);
 
+		long long unmapStart = TraceBegin();
 		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-		switch (glGetError()) {
+		TraceEnd("Unmap", unmapStart);
+		switch (GetGLError()) {
 			case GL_INVALID_ENUM: {
-				agk::DeleteMemblock(memblockID);
-				PluginError("Failed to copy buffer to memblock. Invalid target.");
+				PluginError("Failed to copy buffer range to memblock. Invalid target.");
 				return;
 			}
 			case GL_INVALID_OPERATION: {
-				agk::DeleteMemblock(memblockID);
-				PluginError("Failed to copy buffer to memblock. Target not bound, or is not mapped.");
+				PluginError("Failed to copy buffer range to memblock. Target not bound, or is not mapped.");
 				return;
 			}
 		}
 	}
 
+	DLL_EXPORT unsigned int Compute_RequestBufferReadback(unsigned int bufferID, unsigned int memblockID)
+	{
+		TRACE_COMMAND();
+
+		BufferObjectMap::iterator iter = bufferObjects.find(bufferID);
+		if (iter == bufferObjects.end()) {
+			PluginError("Failed to request readback of unknown buffer %u to memblock %u.", bufferID, memblockID);
+			return 0;
+		}
+
+		BufferObject *bufferObject = iter->second;
+
+		if (!agk::GetMemblockPtr(memblockID)) {
+			PluginError("Failed to request readback of buffer %u to unknown memblock %u.", bufferID, memblockID);
+			return 0;
+		}
+
+		GLsizei size = (GLsizei)agk::GetMemblockSize(memblockID);
+		if (size < bufferObject->bufferSize) {
+			PluginError("Insufficient space in memblock to read back buffer. Memblock is %u bytes and buffer is %u bytes.", size, bufferObject->bufferSize);
+			return 0;
+		}
+
+		StagingBuffer stagingBuffer;
+		if (!AcquireStagingBuffer(bufferObject->bufferSize, &stagingBuffer)) {
+			return 0;
+		}
+
+		glBindBuffer(GL_COPY_READ_BUFFER, bufferObject->bufferName);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, stagingBuffer.bufferName);
+		SyncBufferForTransfer(bufferObject);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, bufferObject->bufferSize);
+		switch (GetGLError()) {
+			case GL_INVALID_VALUE: {
+				PluginError("Failed to request buffer readback. Invalid copy range.");
+				stagingBuffers.push_back(stagingBuffer);
+				return 0;
+			}
+			case GL_INVALID_OPERATION: {
+				PluginError("Failed to request buffer readback. Buffer is mapped or unbound.");
+				stagingBuffers.push_back(stagingBuffer);
+				return 0;
+			}
+		}
+
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		if (!fence) {
+			PluginError("Failed to request buffer readback. Unable to create fence.");
+			stagingBuffers.push_back(stagingBuffer);
+			return 0;
+		}
+
+		if (bufferObject->mappedData) {
+			if (bufferObject->fence) {
+				glDeleteSync(bufferObject->fence);
+			}
+			bufferObject->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+
+		Readback *readback = new Readback(stagingBuffer, bufferObject->bufferSize, fence, memblockID);
+		unsigned int id = readbacks.insert(readback);
+		if (!id) {
+			delete readback;
+		}
+		return id;
+	}
+
+	DLL_EXPORT int Compute_GetReadbackReady(unsigned int readbackID)
+	{
+		TRACE_COMMAND();
+
+		ReadbackMap::iterator iter = readbacks.find(readbackID);
+		if (iter == readbacks.end()) {
+			PluginError("Attempting to query unknown readback %u.", readbackID);
+			return 0;
+		}
+
+		Readback *readback = iter->second;
+
+		GLenum status = glClientWaitSync(readback->fence, readback->flushed ? 0 : GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		readback->flushed = true;
+		if (status == GL_TIMEOUT_EXPIRED) {
+			return 0;
+		}
+
+		if (status == GL_WAIT_FAILED) {
+			PluginError("Failed to complete readback %u. Waiting on the fence failed.", readbackID);
+			delete readback;
+			readbacks.erase(iter);
+			return 0;
+		}
+
+		unsigned char *memblockPtr = agk::GetMemblockPtr(readback->memblockID);
+		if (!memblockPtr || agk::GetMemblockSize(readback->memblockID) < readback->size) {
+			PluginError("Failed to complete readback %u. Memblock %u has been deleted or resized.", readbackID, readback->memblockID);
+			delete readback;
+			readbacks.erase(iter);
+			return 0;
+		}
+
+		glBindBuffer(GL_COPY_READ_BUFFER, readback->staging.bufferName);
+		long long mapStart = TraceBegin();
+		void *data = glMapBuffer(GL_COPY_READ_BUFFER, GL_READ_ONLY);
+		TraceEnd("Map", mapStart);
+		if (!data) {
+			PluginError("Failed to complete readback %u. Unable to map staging buffer.", readbackID);
+			delete readback;
+			readbacks.erase(iter);
+			return 0;
+		}
+
+		long long copyStart = TraceBegin();
+		memcpy(memblockPtr, data, readback->size);
+		TraceEnd("Memcpy", copyStart);
+		TraceTransfer(false, readback->size);
+
+		long long unmapStart = TraceBegin();
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		TraceEnd("Unmap", unmapStart);
+
+		delete readback;
+		readbacks.erase(iter);
+		return 1;
+	}
+
+	DLL_EXPORT void Compute_BeginBatch()
+	{
+		TRACE_COMMAND();
+
+		if (stateCache.batchDepth > 0) {
+			PluginError("Failed to begin batch. A batch has already been started.");
+			return;
+		}
+
+		BeginStateBatch();
+	}
+
+	DLL_EXPORT void Compute_EndBatch()
+	{
+		TRACE_COMMAND();
+
+		if (stateCache.batchDepth == 0) {
+			PluginError("Failed to end batch. No batch has been started.");
+			return;
+		}
+
+		EndStateBatch();
+	}
+
+	DLL_EXPORT unsigned int Compute_BeginCommandList()
+	{
+		TRACE_COMMAND();
+
+		if (recordingList) {
+			PluginError("Failed to begin command list. Another command list is already being recorded.");
+			return 0;
+		}
+
+		CommandList *commandList = new CommandList();
+		unsigned int id = commandLists.insert(commandList);
+		if (!id) {
+			delete commandList;
+			return 0;
+		}
+		recordingList = commandList;
+		return id;
+	}
+
+	DLL_EXPORT void Compute_EndCommandList()
+	{
+		TRACE_COMMAND();
+
+		if (!recordingList) {
+			PluginError("Failed to end command list. No command list is being recorded.");
+			return;
+		}
+
+		recordingList = NULL;
+	}
+
+	DLL_EXPORT void Compute_ExecuteCommandList(unsigned int commandListID)
+	{
+		TRACE_COMMAND();
+
+		UpdateShaderWatch();
+		CommandListMap::iterator iter = commandLists.find(commandListID);
+		if (iter == commandLists.end()) {
+			PluginError("Attempting to execute unknown command list %u.", commandListID);
+			return;
+		}
+
+		CommandList *commandList = iter->second;
+
+		if (commandList == recordingList) {
+			PluginError("Failed to execute command list %u, as it is still being recorded.", commandListID);
+			return;
+		}
+
+		if (!commandList->valid) {
+			PluginError("Failed to execute command list %u, as a shader or buffer it uses has been deleted or reloaded.", commandListID);
+			return;
+		}
+
+		BeginStateBatch();
+		TimerQuery *timerQuery = BeginTimerQuery();
+		if (timerQuery) {
+			timerQuery->commandList = commandList;
+		}
+
+		for (std::vector<Command>::iterator command = commandList->commands.begin(); command != commandList->commands.end(); ++command) {
+			bool succeeded = true;
+			switch (command->type) {
+				case COMMAND_DISPATCH:
+					succeeded = ReplayDispatch(commandList, command->dispatch);
+					break;
+				case COMMAND_SET_UNIFORM: {
+					SetUniformCommand &setUniform = command->setUniform;
+					if (setUniform.isInt) {
+						setUniform.uniform->store(setUniform.index, setUniform.values.i[0], setUniform.values.i[1], setUniform.values.i[2], setUniform.values.i[3]);
+					}
+					else {
+						setUniform.uniform->store(setUniform.index, setUniform.values.f[0], setUniform.values.f[1], setUniform.values.f[2], setUniform.values.f[3]);
+					}
+					break;
+				}
+				case COMMAND_LOAD_UNIFORM: {
+					LoadUniformCommand &loadUniform = command->loadUniform;
+					unsigned char *memblockPtr = agk::GetMemblockPtr(loadUniform.memblockID);
+					int size = (int)sizeof(float) * loadUniform.uniform->vecSize * loadUniform.count;
+					if (!memblockPtr || agk::GetMemblockSize(loadUniform.memblockID) < loadUniform.memblockOffset + size) {
+						PluginError("Failed to execute command list. Memblock %u has been deleted or resized.", loadUniform.memblockID);
+						succeeded = false;
+						break;
+					}
+					loadUniform.uniform->load(memblockPtr + loadUniform.memblockOffset, loadUniform.count);
+					break;
+				}
+				case COMMAND_UPDATE_BUFFER:
+				case COMMAND_COPY_BUFFER:
+					succeeded = ReplayTransfer(command->type, command->transfer);
+					break;
+			}
+			if (!succeeded) {
+				break;
+			}
+		}
+
+		EndTimerQuery(timerQuery);
+		EndStateBatch();
+	}
+
+	DLL_EXPORT void Compute_DeleteCommandList(unsigned int commandListID)
+	{
+		TRACE_COMMAND();
+
+		CommandListMap::iterator iter = commandLists.find(commandListID);
+		if (iter == commandLists.end()) {
+			PluginError("Attempting to delete non-existent command list %u.", commandListID);
+			return;
+		}
+
+		if (iter->second == recordingList) {
+			recordingList = NULL;
+		}
+
+		ForgetTimerQueries(NULL, iter->second);
+		delete iter->second;
+		commandLists.erase(iter);
+	}
+
 	DLL_EXPORT int Compute_GetMaxNumWorkGroupsX()
 	{
+		TRACE_COMMAND();
+
 		GLint max;
 		glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max);
 		return (int)max;
@@ -1158,6 +5022,8 @@ exit_run_shader:
 
 	DLL_EXPORT int Compute_GetMaxNumWorkGroupsY()
 	{
+		TRACE_COMMAND();
+
 		GLint max;
 		glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 1, &max);
 		return (int)max;
@@ -1165,6 +5031,8 @@ exit_run_shader:
 
 	DLL_EXPORT int Compute_GetMaxNumWorkGroupsZ()
 	{
+		TRACE_COMMAND();
+
 		GLint max;
 		glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 2, &max);
 		return (int)max;
@@ -1172,6 +5040,8 @@ exit_run_shader:
 
 	DLL_EXPORT int Compute_GetMaxWorkGroupSizeX()
 	{
+		TRACE_COMMAND();
+
 		GLint max;
 		glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &max);
 		return (int)max;
@@ -1179,6 +5049,8 @@ exit_run_shader:
 
 	DLL_EXPORT int Compute_GetMaxWorkGroupSizeY()
 	{
+		TRACE_COMMAND();
+
 		GLint max;
 		glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 1, &max);
 		return (int)max;
@@ -1186,6 +5058,8 @@ exit_run_shader:
 
 	DLL_EXPORT int Compute_GetMaxWorkGroupSizeZ()
 	{
+		TRACE_COMMAND();
+
 		GLint max;
 		glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 2, &max);
 		return (int)max;
@@ -1193,6 +5067,8 @@ exit_run_shader:
 
 	DLL_EXPORT int Compute_GetMaxWorkGroupSizeTotal()
 	{
+		TRACE_COMMAND();
+
 		GLint max;
 		glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max);
 		return (int)max;
@@ -1200,6 +5076,8 @@ exit_run_shader:
 
 	DLL_EXPORT int Compute_GetMaxSharedMemory()
 	{
+		TRACE_COMMAND();
+
 		GLint max;
 		glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &max);
 		return (int)max;
@@ -1207,6 +5085,8 @@ exit_run_shader:
 
 	DLL_EXPORT int Compute_GetMaxBufferSize()
 	{
+		TRACE_COMMAND();
+
 		GLint64 maxSize;
 		glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxSize);
 		if (maxSize > INT_MAX) {
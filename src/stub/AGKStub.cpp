@@ -0,0 +1,378 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "cImage.h"
+#include "AGKStub.h"
+
+typedef void(*AGKVoidFunc)(void);
+extern "C" void ReceiveAGKPtr(AGKVoidFunc ptr);
+
+// Everything other than the AGKStub_ functions is static, as the names mirror AGK's and would otherwise collide with
+// the plugin's own.
+
+typedef std::unordered_map<unsigned int, std::vector<unsigned char> > MemblockMap;
+typedef std::unordered_map<unsigned int, FILE *> FileMap;
+typedef std::unordered_map<unsigned int, AGK::cImage *> ImageMap;
+
+static MemblockMap memblocks;
+static FileMap files;
+static ImageMap images;
+static unsigned int nextMemblockID = 1;
+static unsigned int nextFileID = 1;
+static unsigned int nextImageID = 1;
+static int errorCount = 0;
+static std::string lastError;
+static bool errorsPrinted = true;
+static float runTime = 0.0f;
+static std::chrono::steady_clock::time_point startTime;
+
+// AGK paths prefixed with raw: are absolute. Everything else is taken as relative to the working directory, which
+// stands in for both the media and write folders.
+static char const *FilePath(char const *file)
+{
+	if (strncmp(file, "raw:", 4) == 0) {
+		return file + 4;
+	}
+	return file;
+}
+
+static float GetRunTime()
+{
+	return runTime;
+}
+
+static void PluginError(char const *message)
+{
+	errorCount += 1;
+	lastError = message;
+	if (errorsPrinted) {
+		fprintf(stderr, "Plugin error: %s\n", message);
+	}
+}
+
+static char *CreateString(unsigned int size)
+{
+	return new char[size];
+}
+
+static void DeleteString(char *str)
+{
+	delete[] str;
+}
+
+static unsigned int CreateMemblock(unsigned int size)
+{
+	unsigned int memblockID = nextMemblockID++;
+	memblocks[memblockID].resize(size);
+	return memblockID;
+}
+
+static void DeleteMemblock(unsigned int memblockID)
+{
+	memblocks.erase(memblockID);
+}
+
+static int GetMemblockExists(unsigned int memblockID)
+{
+	return memblocks.count(memblockID) ? 1 : 0;
+}
+
+static int GetMemblockSize(unsigned int memblockID)
+{
+	MemblockMap::iterator iter = memblocks.find(memblockID);
+	return iter == memblocks.end() ? 0 : (int)iter->second.size();
+}
+
+static unsigned char *GetMemblockPtr(unsigned int memblockID)
+{
+	MemblockMap::iterator iter = memblocks.find(memblockID);
+	if (iter == memblocks.end()) {
+		return NULL;
+	}
+	return iter->second.data();
+}
+
+static unsigned int CreateMemblockFromFile(char const *file)
+{
+	FILE *handle = fopen(FilePath(file), "rb");
+	if (!handle) {
+		return 0;
+	}
+	fseek(handle, 0, SEEK_END);
+	long size = ftell(handle);
+	fseek(handle, 0, SEEK_SET);
+
+	unsigned int memblockID = CreateMemblock((unsigned int)size);
+	if (fread(GetMemblockPtr(memblockID), 1, size, handle) != (size_t)size) {
+		DeleteMemblock(memblockID);
+		memblockID = 0;
+	}
+	fclose(handle);
+	return memblockID;
+}
+
+static void CreateFileFromMemblock(char const *file, unsigned int memblockID)
+{
+	MemblockMap::iterator iter = memblocks.find(memblockID);
+	if (iter == memblocks.end()) {
+		return;
+	}
+	FILE *handle = fopen(FilePath(file), "wb");
+	if (!handle) {
+		return;
+	}
+	fwrite(iter->second.data(), 1, iter->second.size(), handle);
+	fclose(handle);
+}
+
+static int GetFileExists(char const *file)
+{
+	struct stat info;
+	return stat(FilePath(file), &info) == 0 && S_ISREG(info.st_mode) ? 1 : 0;
+}
+
+static void DeleteFile(char const *file)
+{
+	remove(FilePath(file));
+}
+
+static int MakeFolder(char const *folder)
+{
+	mkdir(FilePath(folder), 0755);
+	return 1;
+}
+
+static unsigned int OpenToRead(char const *file)
+{
+	FILE *handle = fopen(FilePath(file), "rb");
+	if (!handle) {
+		return 0;
+	}
+	unsigned int fileID = nextFileID++;
+	files[fileID] = handle;
+	return fileID;
+}
+
+static void CloseFile(unsigned int fileID)
+{
+	FileMap::iterator iter = files.find(fileID);
+	if (iter != files.end()) {
+		fclose(iter->second);
+		files.erase(iter);
+	}
+}
+
+static int FileEOF(unsigned int fileID)
+{
+	FileMap::iterator iter = files.find(fileID);
+	if (iter == files.end()) {
+		return 1;
+	}
+	int c = fgetc(iter->second);
+	if (c == EOF) {
+		return 1;
+	}
+	ungetc(c, iter->second);
+	return 0;
+}
+
+static int GetFileSize(unsigned int fileID)
+{
+	FileMap::iterator iter = files.find(fileID);
+	if (iter == files.end()) {
+		return 0;
+	}
+	long position = ftell(iter->second);
+	fseek(iter->second, 0, SEEK_END);
+	long size = ftell(iter->second);
+	fseek(iter->second, position, SEEK_SET);
+	return (int)size;
+}
+
+// Like AGK, the line is returned without its line ending, and must be freed with DeleteString.
+static char *ReadLine(unsigned int fileID)
+{
+	std::vector<char> line;
+	FileMap::iterator iter = files.find(fileID);
+	if (iter != files.end()) {
+		int c;
+		while ((c = fgetc(iter->second)) != EOF && c != '\n') {
+			if (c != '\r') {
+				line.push_back((char)c);
+			}
+		}
+	}
+	char *str = CreateString((unsigned int)line.size() + 1);
+	if (!line.empty()) {
+		memcpy(str, line.data(), line.size());
+	}
+	str[line.size()] = '\0';
+	return str;
+}
+
+static unsigned int GetImageExists(unsigned int imageID)
+{
+	return images.count(imageID) ? 1 : 0;
+}
+
+static AGK::cImage *GetImagePtr(unsigned int imageID)
+{
+	ImageMap::iterator iter = images.find(imageID);
+	return iter == images.end() ? NULL : iter->second;
+}
+
+struct StubCommand {
+	char const *name;
+	AGKVoidFunc function;
+};
+
+static StubCommand const stubCommands[] = {
+	{ "GETRUNTIME_F_0", (AGKVoidFunc)GetRunTime },
+	{ "PLUGINERROR_0_S", (AGKVoidFunc)PluginError },
+	{ "CREATESTRING_S_L", (AGKVoidFunc)CreateString },
+	{ "DELETESTRING_0_S", (AGKVoidFunc)DeleteString },
+	{ "CREATEMEMBLOCK_L_L", (AGKVoidFunc)CreateMemblock },
+	{ "DELETEMEMBLOCK_0_L", (AGKVoidFunc)DeleteMemblock },
+	{ "GETMEMBLOCKEXISTS_L_L", (AGKVoidFunc)GetMemblockExists },
+	{ "GETMEMBLOCKSIZE_L_L", (AGKVoidFunc)GetMemblockSize },
+	{ "GETMEMBLOCKPTR_P_L", (AGKVoidFunc)GetMemblockPtr },
+	{ "CREATEMEMBLOCKFROMFILE_L_S", (AGKVoidFunc)CreateMemblockFromFile },
+	{ "CREATEFILEFROMMEMBLOCK_0_S_L", (AGKVoidFunc)CreateFileFromMemblock },
+	{ "GETFILEEXISTS_L_S", (AGKVoidFunc)GetFileExists },
+	{ "DELETEFILE_0_S", (AGKVoidFunc)DeleteFile },
+	{ "MAKEFOLDER_L_S", (AGKVoidFunc)MakeFolder },
+	{ "OPENTOREAD_L_S", (AGKVoidFunc)OpenToRead },
+	{ "CLOSEFILE_0_L", (AGKVoidFunc)CloseFile },
+	{ "FILEEOF_L_L", (AGKVoidFunc)FileEOF },
+	{ "GETFILESIZE_L_L", (AGKVoidFunc)GetFileSize },
+	{ "READLINE_S_L", (AGKVoidFunc)ReadLine },
+	{ "GETIMAGEEXISTS_L_L", (AGKVoidFunc)GetImageExists },
+	{ "GETIMAGEPTR_P_L", (AGKVoidFunc)GetImagePtr }
+};
+
+// Commands the stub does not provide are left null, so calling one crashes at the call rather than misbehaving.
+static AGKVoidFunc GetStubFunction(char const *name)
+{
+	for (size_t i = 0; i < sizeof(stubCommands) / sizeof(stubCommands[0]); ++i) {
+		if (strcmp(stubCommands[i].name, name) == 0) {
+			return stubCommands[i].function;
+		}
+	}
+	return NULL;
+}
+
+bool AGKStub_CreateContext()
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	EGLDisplay display = eglGetPlatformDisplayEXT ? eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) : EGL_NO_DISPLAY;
+	if (display == EGL_NO_DISPLAY) {
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+
+	EGLint major, minor;
+	if (!eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "Failed to initialise EGL.\n");
+		return false;
+	}
+
+	EGLint const contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 4,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		fprintf(stderr, "Failed to create a surfaceless OpenGL 4.4 context.\n");
+		return false;
+	}
+	return true;
+}
+
+void AGKStub_Install()
+{
+	startTime = std::chrono::steady_clock::now();
+	ReceiveAGKPtr((AGKVoidFunc)GetStubFunction);
+}
+
+void AGKStub_Sync()
+{
+	runTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned int AGKStub_CreateImage(int width, int height)
+{
+	GLuint textureName;
+	glGenTextures(1, &textureName);
+	glBindTexture(GL_TEXTURE_2D, textureName);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// cImage's constructor lives in the engine. The plugin only reads the texture name and size, so a zeroed block with
+	// those fields filled in is enough.
+	AGK::cImage *image = (AGK::cImage *)calloc(1, sizeof(AGK::cImage));
+	image->m_iTextureID = textureName;
+	image->m_iWidth = width;
+	image->m_iHeight = height;
+	image->m_iOrigWidth = width;
+	image->m_iOrigHeight = height;
+
+	unsigned int imageID = nextImageID++;
+	image->m_iID = imageID;
+	images[imageID] = image;
+	return imageID;
+}
+
+void AGKStub_DeleteImage(unsigned int imageID)
+{
+	ImageMap::iterator iter = images.find(imageID);
+	if (iter == images.end()) {
+		return;
+	}
+	GLuint textureName = iter->second->m_iTextureID;
+	glDeleteTextures(1, &textureName);
+	free(iter->second);
+	images.erase(iter);
+}
+
+bool AGKStub_ReadImage(unsigned int imageID, unsigned char *pixels)
+{
+	ImageMap::iterator iter = images.find(imageID);
+	if (iter == images.end()) {
+		return false;
+	}
+	// Shaders write images through image stores, which are only visible to texture reads after a barrier.
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	glBindTexture(GL_TEXTURE_2D, iter->second->m_iTextureID);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return true;
+}
+
+int AGKStub_GetErrorCount()
+{
+	return errorCount;
+}
+
+void AGKStub_ResetErrorCount()
+{
+	errorCount = 0;
+}
+
+char const *AGKStub_GetLastError()
+{
+	return lastError.c_str();
+}
+
+void AGKStub_SetErrorsPrinted(bool printed)
+{
+	errorsPrinted = printed;
+}
@@ -0,0 +1,34 @@
+#ifndef _H_AGK_STUB
+#define _H_AGK_STUB
+
+// A stand-in for the parts of the AppGameKit runtime that the plugin uses, so that the plugin can be driven from native
+// code without the engine.
+
+// Creates a surfaceless OpenGL 4.4 core context through EGL and makes it current, so that the plugin can run without a
+// display. Drivers that already have a context of their own need not call this.
+bool AGKStub_CreateContext();
+
+// Hands the stub's commands to the plugin. Must be called once, before any plugin command.
+void AGKStub_Install();
+
+// Equivalent of Sync for the purposes of the plugin: updates the value returned by GetRunTime.
+void AGKStub_Sync();
+
+// Creates an RGBA8 image backed by a GL texture, for use with SetShaderImage. Returns the image ID.
+unsigned int AGKStub_CreateImage(int width, int height);
+void AGKStub_DeleteImage(unsigned int imageID);
+
+// Copies the RGBA8 contents of an image into pixels, which must hold width * height * 4 bytes.
+bool AGKStub_ReadImage(unsigned int imageID, unsigned char *pixels);
+
+// Returns the number of errors reported by the plugin since the stub was installed or the count was last reset.
+int AGKStub_GetErrorCount();
+void AGKStub_ResetErrorCount();
+
+// Returns the most recent error reported by the plugin, or an empty string if there has been none.
+char const *AGKStub_GetLastError();
+
+// Errors are printed to stderr as they are reported, unless turned off here.
+void AGKStub_SetErrorsPrinted(bool printed);
+
+#endif
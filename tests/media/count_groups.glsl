@@ -0,0 +1,11 @@
+layout (local_size_x = 1) in;
+
+layout (std430, binding = 0) buffer Counter
+{
+	uint count;
+} data;
+
+void main()
+{
+	atomicAdd(data.count, 1u);
+}
@@ -0,0 +1,20 @@
+layout (local_size_x = 8, local_size_y = 4) in;
+
+uniform ivec3 agk_InvocationCount;
+
+layout (std430, binding = 0) buffer Counter
+{
+	uint count;
+	int invocationCount[3];
+} data;
+
+void main()
+{
+	if (gl_GlobalInvocationID.x >= uint(agk_InvocationCount.x) || gl_GlobalInvocationID.y >= uint(agk_InvocationCount.y)) {
+		return;
+	}
+	atomicAdd(data.count, 1u);
+	data.invocationCount[0] = agk_InvocationCount.x;
+	data.invocationCount[1] = agk_InvocationCount.y;
+	data.invocationCount[2] = agk_InvocationCount.z;
+}
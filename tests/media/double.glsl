@@ -0,0 +1,11 @@
+layout (local_size_x = 10) in;
+
+layout (std430, binding = 0) buffer Values
+{
+	int values[10];
+} data;
+
+void main()
+{
+	data.values[gl_LocalInvocationID.x] *= 2;
+}
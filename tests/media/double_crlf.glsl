@@ -0,0 +1,14 @@
+layout (local_size_x = 10) in;
+
+#define DOUBLE(x) \
+	((x) * 2)
+
+layout (std430, binding = 0) buffer Values
+{
+	int values[10];
+} data;
+
+void main()
+{
+	data.values[gl_LocalInvocationID.x] = DOUBLE(data.values[gl_LocalInvocationID.x]);
+}
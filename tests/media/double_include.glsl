@@ -0,0 +1,9 @@
+layout (local_size_x = 10) in;
+
+#include "include/values.glsl"
+#include "include/double_value.glsl"
+
+void main()
+{
+	doubleValue(gl_LocalInvocationID.x);
+}
@@ -0,0 +1,6 @@
+#include "values.glsl"
+
+void doubleValue(uint index)
+{
+	data.values[index] *= 2;
+}
@@ -0,0 +1,4 @@
+layout (std430, binding = 0) buffer Values
+{
+	int values[10];
+} data;
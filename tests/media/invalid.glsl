@@ -0,0 +1,5 @@
+layou (local_size_x = 1) in;
+
+void main()
+{
+}
@@ -0,0 +1,7 @@
+layout (local_size_x = 10) in;
+
+#include "include/non_existent.glsl"
+
+void main()
+{
+}
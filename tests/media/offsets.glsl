@@ -0,0 +1,13 @@
+layout (local_size_x = 10) in;
+
+layout (location = 0) uniform int offsets[10];
+
+layout (std430, binding = 0) buffer Values
+{
+	int values[10];
+} data;
+
+void main()
+{
+	data.values[gl_LocalInvocationID.x] = offsets[gl_LocalInvocationID.x];
+}
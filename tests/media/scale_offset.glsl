@@ -0,0 +1,18 @@
+layout (local_size_x = 10) in;
+
+layout (std140) uniform Params
+{
+	int scale;
+	int offsets[10];
+};
+
+layout (std430, binding = 0) buffer Values
+{
+	int values[10];
+} data;
+
+void main()
+{
+	uint i = gl_LocalInvocationID.x;
+	data.values[i] = data.values[i] * scale + offsets[i];
+}
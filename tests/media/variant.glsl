@@ -0,0 +1,20 @@
+#ifndef FACTOR
+#define FACTOR 2
+#endif
+
+layout (local_size_x = 10) in;
+
+layout (std430, binding = 0) buffer Values
+{
+	int values[10];
+} data;
+
+uniform int offset;
+
+void main()
+{
+#ifdef NEGATE
+	data.values[gl_LocalInvocationID.x] = -data.values[gl_LocalInvocationID.x];
+#endif
+	data.values[gl_LocalInvocationID.x] = data.values[gl_LocalInvocationID.x] * FACTOR + offset;
+}
@@ -0,0 +1,13 @@
+layout (local_size_x = 1) in;
+
+layout (std430, binding = 0) buffer GroupCounts
+{
+	uint numGroups[3];
+} data;
+
+void main()
+{
+	data.numGroups[0] = 3u;
+	data.numGroups[1] = 2u;
+	data.numGroups[2] = 1u;
+}